@@ -0,0 +1,369 @@
+#include "icemet/worker.hpp"
+#include "icemet/core/bgsub.hpp"
+#include "icemet/core/database.hpp"
+#include "icemet/core/file.hpp"
+#include "icemet/core/math.hpp"
+#include "icemet/core/pool.hpp"
+#include "bench/micro.hpp"
+#include "bench/synth.hpp"
+#include "server/analysis.hpp"
+#include "server/preproc.hpp"
+#include "server/recon.hpp"
+#include "server/stats.hpp"
+
+#include <opencv2/core.hpp>
+#include <opencv2/icemet.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FOCUS_TILE 512
+#define FOCUS_PLANES 64
+
+// Workers with their per-frame steps exposed
+class PreprocProbe : public Preproc {
+public:
+	using Preproc::Preproc;
+	using Preproc::dynRange;
+};
+
+class ReconProbe : public Recon {
+public:
+	using Recon::Recon;
+	using Recon::allocate;
+	using Recon::process;
+};
+
+class AnalysisProbe : public Analysis {
+public:
+	using Analysis::Analysis;
+	using Analysis::analyse;
+	using Analysis::unique;
+};
+
+class StatsProbe : public Stats {
+public:
+	using Stats::Stats;
+	using Stats::fillStatsRow;
+	
+	void setParticles(const cv::Mat& diams)
+	{
+		m_particles = diams;
+		m_frames = 1;
+	}
+};
+
+// Synthetic frame cropped like a preprocessed image
+static const cv::UMat& frame()
+{
+	static cv::UMat img;
+	if (img.empty()) {
+		const Config& cfg = Micro::config();
+		Synth synth(&cfg);
+		cv::Mat full;
+		std::vector<SynthParticle> particles;
+		synth.generate(20, full, particles);
+		full(cfg.img.rect).copyTo(img);
+	}
+	return img;
+}
+
+// Planes around the first droplet of the synthetic frame
+static std::vector<cv::UMat>& stack()
+{
+	static std::vector<cv::UMat> planes;
+	if (planes.empty()) {
+		const Config& cfg = Micro::config();
+		Synth synth(&cfg);
+		cv::Mat full;
+		std::vector<SynthParticle> particles;
+		synth.generate(1, full, particles);
+		
+		const SynthParticle& par = particles[0];
+		cv::Rect rect((int)par.x - FOCUS_TILE/2, (int)par.y - FOCUS_TILE/2, FOCUS_TILE, FOCUS_TILE);
+		rect &= cv::Rect(0, 0, full.cols, full.rows);
+		cv::UMat tile(FOCUS_TILE, FOCUS_TILE, CV_8UC1, cv::Scalar(128));
+		full(rect).copyTo(tile(cv::Rect(0, 0, rect.width, rect.height)));
+		
+		cv::Ptr<cv::icemet::Hologram> hologram = cv::icemet::Hologram::create(
+			tile.size(),
+			cfg.hologram.psz, cfg.hologram.lambda,
+			cfg.hologram.dist
+		);
+		cv::icemet::ZRange z = cfg.hologram.z;
+		z.start = par.z - FOCUS_PLANES/2 * z.step;
+		z.stop = z.start + FOCUS_PLANES * z.step;
+		cv::UMat imgMin;
+		hologram->setImg(tile);
+		hologram->reconMin(planes, imgMin, z);
+	}
+	return planes;
+}
+
+static void median(MicroState& state)
+{
+	cv::UMat img(state.arg(), state.arg(), CV_8UC1);
+	cv::randn(img, 128, 20);
+	while (state.run())
+		microUse(Math::median(img));
+}
+MICRO_ARGS(median, [](const Config& cfg) {
+	return std::vector<long long>{256, 1024, cfg.img.size.width};
+});
+
+static void dyn_range(MicroState& state)
+{
+	Config cfg(Micro::config());
+	ImagePool pool;
+	PreprocProbe preproc(&cfg, &pool);
+	const cv::UMat& img = frame();
+	while (state.run())
+		microUse(preproc.dynRange(img));
+}
+MICRO(dyn_range);
+
+static void bgsub_meddiv(MicroState& state)
+{
+	const Config& cfg = Micro::config();
+	cv::Ptr<cv::icemet::BGSubStack> stack = cv::icemet::BGSubStack::create(cfg.img.size, state.arg());
+	cv::UMat img(cfg.img.size, CV_8UC1), dst;
+	for (long long i = 0; i < state.arg(); i++) {
+		cv::randn(img, 128, 20);
+		stack->push(img);
+	}
+	while (state.run())
+		stack->meddiv(dst);
+}
+MICRO_ARGS(bgsub_meddiv, [](const Config& cfg) {
+	return std::vector<long long>{3, cfg.bgsub.stackLen, 2*cfg.bgsub.stackLen+1};
+});
+
+static void median_meddiv(MicroState& state)
+{
+	const Config& cfg = Micro::config();
+	MedianStack stack(cfg.img.size, state.arg());
+	cv::UMat img(cfg.img.size, CV_8UC1), dst;
+	for (long long i = 0; i < state.arg(); i++) {
+		cv::randn(img, 128, 20);
+		stack.push(img);
+	}
+	while (state.run())
+		stack.meddiv(dst);
+}
+MICRO_ARGS(median_meddiv, [](const Config& cfg) {
+	return std::vector<long long>{3, cfg.bgsub.stackLen, 2*cfg.bgsub.stackLen+1};
+});
+
+// One reconstruction chunk of arg planes
+static void recon_process(MicroState& state)
+{
+	Config cfg(Micro::config());
+	cfg.hologram.step = state.arg();
+	cfg.hologram.limitZ = false;
+	cfg.hologram.z.start = cfg.particle.zMin;
+	cfg.hologram.z.stop = cfg.particle.zMin + state.arg() * cfg.hologram.z.step;
+	ImagePool pool;
+	ReconProbe recon(&cfg, &pool);
+	recon.allocate();
+	const cv::UMat& img = frame();
+	unsigned char bgVal = Math::median(img);
+	while (state.run()) {
+		FilePtr file = cv::makePtr<File>();
+		file->preproc = img;
+		file->param.bgVal = bgVal;
+		recon.process(file);
+	}
+}
+MICRO_ARGS(recon_process, [](const Config& cfg) {
+	return std::vector<long long>{32, 128, cfg.hologram.step};
+});
+
+static void focus(MicroState& state, cv::icemet::FocusMethod method)
+{
+	std::vector<cv::UMat>& planes = stack();
+	int size = state.arg();
+	cv::Rect rect((FOCUS_TILE - size) / 2, (FOCUS_TILE - size) / 2, size, size);
+	float K = Micro::config().hologram.focusK;
+	int idx;
+	double score;
+	while (state.run())
+		cv::icemet::Hologram::focus(planes, rect, idx, score, method, 0, planes.size()-1, K);
+}
+
+static void focus_std(MicroState& state)
+{
+	focus(state, cv::icemet::FOCUS_STD);
+}
+MICRO_ARGS(focus_std, [](const Config&) {
+	return std::vector<long long>{16, 64, 256};
+});
+
+static void focus_min(MicroState& state)
+{
+	focus(state, cv::icemet::FOCUS_MIN);
+}
+MICRO_ARGS(focus_min, [](const Config&) {
+	return std::vector<long long>{16, 64, 256};
+});
+
+// Dark blurred disk in an arg x arg segment
+static void analyse(MicroState& state)
+{
+	Config cfg(Micro::config());
+	ImagePool pool;
+	AnalysisProbe analysis(&cfg, &pool);
+	
+	int size = state.arg();
+	FilePtr file = cv::makePtr<File>();
+	file->param.bgVal = 128;
+	SegmentPtr segm = cv::makePtr<Segment>();
+	segm->z = cfg.particle.zMin;
+	segm->iter = 0;
+	segm->score = 0.0;
+	segm->method = cv::icemet::FOCUS_STD;
+	segm->rect = cv::Rect(cfg.img.border.width, cfg.img.border.height, size, size);
+	segm->img = cv::Mat(size, size, CV_8UC1, cv::Scalar(128));
+	cv::circle(segm->img, cv::Point(size/2, size/2), size/6, cv::Scalar(30), cv::FILLED);
+	cv::GaussianBlur(segm->img, segm->img, cv::Size(3, 3), 0);
+	
+	cv::Mat bufTh(cfg.img.size, CV_8UC1), bufPar(cfg.img.size, CV_8UC1);
+	ParticlePtr par;
+	while (state.run())
+		microUse(analysis.analyse(file, segm, bufTh, bufPar, par));
+}
+MICRO_ARGS(analyse, [](const Config&) {
+	return std::vector<long long>{16, 64, 256};
+});
+
+// Overlap pass over arg segments scattered in the frame
+static void unique(MicroState& state)
+{
+	Config cfg(Micro::config());
+	ImagePool pool;
+	AnalysisProbe analysis(&cfg, &pool);
+	
+	cv::RNG rng(0x1ce3e7);
+	std::vector<SegmentPtr> segments;
+	std::vector<ParticlePtr> particles;
+	for (long long i = 0; i < state.arg(); i++) {
+		SegmentPtr segm = cv::makePtr<Segment>();
+		int w = rng.uniform(8, 64), h = rng.uniform(8, 64);
+		segm->rect = cv::Rect(rng.uniform(0, cfg.img.size.width-w), rng.uniform(0, cfg.img.size.height-h), w, h);
+		segm->iter = rng.uniform(0, 4);
+		segm->score = rng.uniform(0.0, 1.0);
+		segm->method = cv::icemet::FOCUS_STD;
+		ParticlePtr par = cv::makePtr<Particle>();
+		par->dynRange = rng.uniform(0, 256);
+		segments.push_back(segm);
+		particles.push_back(par);
+	}
+	
+	std::vector<SegmentPtr> segmentsUnique;
+	std::vector<ParticlePtr> particlesUnique;
+	while (state.run()) {
+		segmentsUnique.clear();
+		particlesUnique.clear();
+		analysis.unique(segments, particles, segmentsUnique, particlesUnique);
+	}
+}
+MICRO_ARGS(unique, [](const Config&) {
+	return std::vector<long long>{100, 1000, 10000};
+});
+
+static void fill_stats_row(MicroState& state)
+{
+	Config cfg(Micro::config());
+	StatsProbe stats(&cfg, NULL);
+	cv::Mat diams(state.arg(), 1, CV_64F);
+	cv::randu(diams, cfg.particle.diamMin, cfg.particle.diamMax);
+	stats.setParticles(diams);
+	StatsRow row;
+	while (state.run())
+		stats.fillStatsRow(row);
+}
+MICRO_ARGS(fill_stats_row, [](const Config&) {
+	return std::vector<long long>{100, 1000, 10000};
+});
+
+static void file_name(MicroState& state)
+{
+	File file(1, DateTime(1577836800000ULL), 123, FILE_STATUS_NOTEMPTY);
+	while (state.run())
+		microUse(file.name());
+}
+MICRO(file_name);
+
+static void file_set_name(MicroState& state)
+{
+	File file(1, DateTime(1577836800000ULL), 123, FILE_STATUS_NOTEMPTY);
+	const std::string name = file.name();
+	while (state.run())
+		file.setName(name);
+}
+MICRO(file_set_name);
+
+static void particle_query(MicroState& state)
+{
+	Database db;
+	ParticleRow row = {
+		0, DateTime(1577836800000ULL), 1, 123, 4,
+		1.0e-3, 2.0e-3, 20.0e-3,
+		20.0e-6, 1.0, 0.9, 120, 3.0e-6,
+		cv::Rect(100, 200, 32, 32)
+	};
+	while (state.run())
+		microUse(db.particleQuery(row));
+}
+MICRO(particle_query);
+
+static void stats_query(MicroState& state)
+{
+	Database db;
+	StatsRow row = {0, DateTime(1577836800000ULL), 0.1, 20.0e-6, 1.0e6, 100, 1000};
+	while (state.run())
+		microUse(db.statsQuery(row));
+}
+MICRO(stats_query);
+
+// Hand-off of one file through an arg-sized queue to a spinning consumer
+static void handoff(MicroState& state, bool ring)
+{
+	FileQueue queue(state.arg());
+	int producer, consumer, other;
+	queue.link(&producer, &consumer);
+	if (!ring)
+		queue.link(&other, &consumer);
+	
+	std::atomic<bool> done(false);
+	std::thread thread([&]() {
+		std::vector<FilePtr> files;
+		while (!done.load() || !queue.empty()) {
+			queue.popBatch(files);
+			files.clear();
+		}
+	});
+	FilePtr file = cv::makePtr<File>();
+	while (state.run())
+		queue.push(file);
+	done.store(true);
+	thread.join();
+}
+
+static void queue_mutex(MicroState& state)
+{
+	handoff(state, false);
+}
+MICRO_ARGS(queue_mutex, [](const Config&) {
+	return std::vector<long long>{2, 1024};
+});
+
+static void queue_ring(MicroState& state)
+{
+	handoff(state, true);
+}
+MICRO_ARGS(queue_ring, [](const Config&) {
+	return std::vector<long long>{2, 1024};
+});
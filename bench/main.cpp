@@ -0,0 +1,217 @@
+#include "icemet/util/log.hpp"
+#include "icemet/util/metrics.hpp"
+#include "icemet/util/strfmt.hpp"
+#include "icemet/util/time.hpp"
+#include "bench/memdb.hpp"
+#include "bench/synth.hpp"
+#include "server/pipeline.hpp"
+
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define BENCH_EPOCH 1577836800000ULL // 2020-01-01 00:00:00
+#define BENCH_FRAME_MS 100
+
+static const char* usageStr = "Usage: icemet-bench [options] config.yaml\n";
+static const char* helpStr =
+"Options:\n"
+"  -h                Print this help message and exit\n"
+"  -n FRAMES         Number of synthetic frames (default 20)\n"
+"  -p PARTICLES      Droplets per frame (default 20)\n"
+"  -S SEED           Generator seed\n"
+"  -o FILE           Write the JSON report to FILE instead of stdout\n"
+"  -k                Keep the generated frames and results\n"
+"  -d                Enable debug messages.\n";
+
+static int cvErrorHandler(int status, const char* func, const char* msg, const char* fn, int line, void* data)
+{
+	(void)status;
+	(void)func;
+	(void)msg;
+	(void)fn;
+	(void)line;
+	(void)data;
+	return 0;
+}
+
+static std::string report(double sec, int frames, unsigned int truth, MemoryDatabase& db)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	
+	std::string out("{\n");
+	out += strfmt("  \"frames\": %d,\n", frames);
+	out += strfmt("  \"seconds\": %.3f,\n", sec);
+	out += strfmt("  \"frames_per_second\": %.3f,\n", sec > 0.0 ? frames / sec : 0.0);
+	out += strfmt("  \"peak_rss_kb\": %ld,\n", usage.ru_maxrss);
+	out += strfmt("  \"particles_generated\": %u,\n", truth);
+	out += strfmt("  \"particles_saved\": %zu,\n", db.particles());
+	out += strfmt("  \"stats_rows\": %zu,\n", db.stats());
+	
+	out += "  \"stages\": {";
+	std::vector<WorkerMetrics*> workers = Metrics::workers();
+	for (size_t i = 0; i < workers.size(); i++) {
+		const Histogram& hist = workers[i]->service();
+		out += strfmt(
+			"%s\n    \"%s\": {\"frames\": %llu, \"mean\": %.6f, \"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f}",
+			i ? "," : "", workers[i]->name().c_str(), workers[i]->frames(),
+			hist.count() ? hist.sum() / hist.count() : 0.0,
+			hist.quantile(0.5), hist.quantile(0.9), hist.quantile(0.99)
+		);
+	}
+	out += "\n  },\n";
+	
+	out += "  \"queues\": {";
+	std::vector<QueueMetrics*> queues = Metrics::queues();
+	for (size_t i = 0; i < queues.size(); i++) {
+		const Histogram& hist = queues[i]->wait();
+		out += strfmt(
+			"%s\n    \"%s\": {\"wait_p50\": %.6f, \"wait_p99\": %.6f, \"blocked\": %.6f}",
+			i ? "," : "", queues[i]->name().c_str(),
+			hist.quantile(0.5), hist.quantile(0.99), queues[i]->blocked()
+		);
+	}
+	out += "\n  }\n}\n";
+	return out;
+}
+
+int main(int argc, char* argv[])
+{
+	Arguments args;
+	args.root = fs::path(argv[0]).parent_path();
+	args.waitNew = false;
+	int frames = 20;
+	int particles = 20;
+	uint64 seed = 0x1ce3e7;
+	fs::path output;
+	bool keep = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		bool hasValue = i + 1 < argc;
+		if (arg[0] == '-') {
+			if (!arg.compare("-h")) {
+				printf("%s\n%s", usageStr, helpStr);
+				return EXIT_SUCCESS;
+			}
+			else if (!arg.compare("-n") && hasValue) {
+				frames = std::stoi(argv[++i]);
+			}
+			else if (!arg.compare("-p") && hasValue) {
+				particles = std::stoi(argv[++i]);
+			}
+			else if (!arg.compare("-S") && hasValue) {
+				seed = std::stoull(argv[++i]);
+			}
+			else if (!arg.compare("-o") && hasValue) {
+				output = argv[++i];
+			}
+			else if (!arg.compare("-k")) {
+				keep = true;
+			}
+			else if (!arg.compare("-d")) {
+				args.loglevel = LOG_DEBUG;
+			}
+			else {
+				printf("Invalid option '%s'\n", arg.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+		else {
+			args.cfgFile = arg;
+		}
+	}
+	if (args.cfgFile.empty()) {
+		printf(usageStr);
+		return EXIT_FAILURE;
+	}
+	
+	Log log("BENCH");
+	try {
+		cv::redirectError(cvErrorHandler);
+		
+		// Read config and redirect all files to a scratch directory
+		Config cfg(args);
+		Log::setLevel(args.loglevel);
+		fs::path root = fs::temp_directory_path() / fs::path(strfmt("icemet-bench-%d", (int)getpid()));
+		cfg.paths.watch = root / fs::path("watch");
+		cfg.paths.results = root / fs::path("results");
+		cfg.paths.original = cfg.paths.results / fs::path("original");
+		cfg.paths.preproc = cfg.paths.results / fs::path("preproc");
+		cfg.paths.recon = cfg.paths.results / fs::path("recon");
+		cfg.paths.threshold = cfg.paths.results / fs::path("threshold");
+		cfg.paths.preview = cfg.paths.results / fs::path("preview");
+		cfg.metrics.file = fs::path();
+		cfg.metrics.port = 0;
+		
+		// Initialize OpenCL
+		const char* device = cfg.ocl.device.c_str();
+		std::vector<char> vec = vecfmt("OPENCV_OPENCL_DEVICE=%s", device);
+		if (putenv(&vec[0]) || !cv::ocl::useOpenCL())
+			throw std::runtime_error("OpenCL not available");
+		log.info("OpenCL device %s:%s", device, cv::ocl::Device::getDefault().name().c_str());
+		
+		// Generate the frames before timing anything
+		Synth synth(&cfg, seed);
+		unsigned int truth = 0;
+		Measure mGen;
+		for (int i = 0; i < frames; i++) {
+			cv::Mat img;
+			std::vector<SynthParticle> generated;
+			synth.generate(particles, img, generated);
+			truth += generated.size();
+			
+			File file(1, DateTime(BENCH_EPOCH + (Timestamp)i*BENCH_FRAME_MS), i + 1, FILE_STATUS_NONE);
+			fs::create_directories(file.dir(cfg.paths.watch));
+			if (!cv::imwrite(file.path(cfg.paths.watch, ".png").string(), img))
+				throw std::runtime_error("Couldn't write " + file.name());
+		}
+		log.info("Generated %d frames of %dx%d with %u droplets (%.2f s)",
+			frames, synth.size().width, synth.size().height, truth, mGen.time()
+		);
+		
+		// Run the whole pipeline once over the frames
+		MemoryDatabase db;
+		double sec;
+		std::string json;
+		{
+			Pipeline pipeline(&cfg, &db);
+			Measure m;
+			pipeline.start();
+			pipeline.join();
+			sec = m.time();
+			json = report(sec, frames, truth, db);
+		}
+		log.info("Processed %d frames in %.2f s (%.2f fps)", frames, sec, frames / sec);
+		
+		if (output.empty()) {
+			printf("%s", json.c_str());
+		}
+		else {
+			std::ofstream out(output);
+			out << json;
+			if (!out)
+				throw std::runtime_error("Couldn't write " + output.string());
+		}
+		
+		if (!keep)
+			fs::remove_all(root);
+		else
+			log.info("Kept %s", root.string().c_str());
+		return EXIT_SUCCESS;
+	}
+	catch (std::exception& e) {
+		log.critical(e.what());
+	}
+	return EXIT_FAILURE;
+}
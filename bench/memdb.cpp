@@ -0,0 +1,36 @@
+#include "memdb.hpp"
+
+void MemoryDatabase::writeParticle(const ParticleRow& row)
+{
+	std::lock_guard<std::mutex> lock(m_rowsMutex);
+	m_particles.push_back(row);
+	m_particles.back().id = m_particles.size();
+}
+
+void MemoryDatabase::writeStats(const StatsRow& row)
+{
+	std::lock_guard<std::mutex> lock(m_rowsMutex);
+	m_stats.push_back(row);
+	m_stats.back().id = m_stats.size();
+}
+
+void MemoryDatabase::readParticles(std::vector<ParticleRow>& rows, unsigned int minId)
+{
+	std::lock_guard<std::mutex> lock(m_rowsMutex);
+	for (const auto& row : m_particles) {
+		if (row.id >= minId)
+			rows.push_back(row);
+	}
+}
+
+size_t MemoryDatabase::particles()
+{
+	std::lock_guard<std::mutex> lock(m_rowsMutex);
+	return m_particles.size();
+}
+
+size_t MemoryDatabase::stats()
+{
+	std::lock_guard<std::mutex> lock(m_rowsMutex);
+	return m_stats.size();
+}
@@ -0,0 +1,27 @@
+#ifndef ICEMET_BENCH_MEMDB_H
+#define ICEMET_BENCH_MEMDB_H
+
+#include "icemet/core/database.hpp"
+
+#include <mutex>
+#include <vector>
+
+// Database stand-in that keeps the rows in memory
+class MemoryDatabase : public Database {
+private:
+	std::vector<ParticleRow> m_particles;
+	std::vector<StatsRow> m_stats;
+	std::mutex m_rowsMutex;
+
+public:
+	MemoryDatabase() {}
+	
+	void writeParticle(const ParticleRow& row) override;
+	void writeStats(const StatsRow& row) override;
+	void readParticles(std::vector<ParticleRow>& rows, unsigned int minId=0) override;
+	
+	size_t particles();
+	size_t stats();
+};
+
+#endif
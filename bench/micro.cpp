@@ -0,0 +1,191 @@
+#include "micro.hpp"
+
+#include "icemet/util/log.hpp"
+#include "icemet/util/strfmt.hpp"
+
+#include <opencv2/core/ocl.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+
+typedef struct _micro_entry {
+	std::string name;
+	MicroFunc func;
+	MicroArgs args;
+} MicroEntry;
+
+static const char* usageStr = "Usage: icemet-micro [options] config.yaml\n";
+static const char* helpStr =
+"Options:\n"
+"  -h                Print this help message and exit\n"
+"  -f FILTER         Run only the benchmarks whose name contains FILTER\n"
+"  -t SECONDS        Minimum time of each measurement (default 0.5)\n"
+"  -o FILE           Write the results as JSON to FILE\n"
+"  -d                Enable debug messages.\n";
+
+static const Config* microConfig = NULL;
+
+static std::vector<MicroEntry>& entries()
+{
+	static std::vector<MicroEntry> vec;
+	return vec;
+}
+
+MicroState::MicroState(long long arg, unsigned long long iters) :
+	m_arg(arg),
+	m_iters(iters),
+	m_left(iters),
+	m_time(0.0),
+	m_started(false) {}
+
+bool MicroState::run()
+{
+	auto now = chr::steady_clock::now();
+	if (!m_started) {
+		m_started = true;
+		m_start = now;
+	}
+	if (!m_left) {
+		m_time = chr::duration<double>(now - m_start).count();
+		return false;
+	}
+	m_left--;
+	return true;
+}
+
+void MicroState::pause()
+{
+	m_pause = chr::steady_clock::now();
+}
+
+void MicroState::resume()
+{
+	m_start += chr::steady_clock::now() - m_pause;
+}
+
+Micro::Micro(const char* name, MicroFunc func, MicroArgs args)
+{
+	entries().push_back({name, func, args});
+}
+
+const Config& Micro::config()
+{
+	return *microConfig;
+}
+
+static int cvErrorHandler(int status, const char* func, const char* msg, const char* fn, int line, void* data)
+{
+	(void)status;
+	(void)func;
+	(void)msg;
+	(void)fn;
+	(void)line;
+	(void)data;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	Arguments args;
+	args.root = fs::path(argv[0]).parent_path();
+	std::string filter;
+	double minTime = 0.5;
+	fs::path output;
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		bool hasValue = i + 1 < argc;
+		if (arg[0] == '-') {
+			if (!arg.compare("-h")) {
+				printf("%s\n%s", usageStr, helpStr);
+				return EXIT_SUCCESS;
+			}
+			else if (!arg.compare("-f") && hasValue) {
+				filter = argv[++i];
+			}
+			else if (!arg.compare("-t") && hasValue) {
+				minTime = std::stod(argv[++i]);
+			}
+			else if (!arg.compare("-o") && hasValue) {
+				output = argv[++i];
+			}
+			else if (!arg.compare("-d")) {
+				args.loglevel = LOG_DEBUG;
+			}
+			else {
+				printf("Invalid option '%s'\n", arg.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+		else {
+			args.cfgFile = arg;
+		}
+	}
+	if (args.cfgFile.empty()) {
+		printf(usageStr);
+		return EXIT_FAILURE;
+	}
+	
+	Log log("MICRO");
+	try {
+		cv::redirectError(cvErrorHandler);
+		Config cfg(args);
+		microConfig = &cfg;
+		Log::setLevel(args.loglevel);
+		
+		// Initialize OpenCL
+		const char* device = cfg.ocl.device.c_str();
+		std::vector<char> vec = vecfmt("OPENCV_OPENCL_DEVICE=%s", device);
+		if (putenv(&vec[0]) || !cv::ocl::useOpenCL())
+			throw std::runtime_error("OpenCL not available");
+		log.info("OpenCL device %s:%s", device, cv::ocl::Device::getDefault().name().c_str());
+		
+		printf("%-32s %15s %12s\n", "Benchmark", "Time/iter (ns)", "Iterations");
+		std::string json("[");
+		int n = 0;
+		for (const auto& entry : entries()) {
+			if (entry.name.find(filter) == std::string::npos)
+				continue;
+			std::vector<long long> values = entry.args ? entry.args(cfg) : std::vector<long long>{0};
+			for (long long value : values) {
+				// Grow the iteration count until the measurement is long
+				// enough, aiming a bit over the minimum time
+				unsigned long long iters = 1;
+				double t;
+				while (true) {
+					MicroState state(value, iters);
+					entry.func(state);
+					t = state.time();
+					if (t >= minTime || iters >= 1000000000ULL)
+						break;
+					double scale = t > 0.0 ? 1.4 * minTime / t : 10.0;
+					iters = std::max(iters + 1, (unsigned long long)(iters * std::min(10.0, std::max(1.5, scale))));
+				}
+				
+				std::string name = entry.args ? strfmt("%s/%lld", entry.name.c_str(), value) : entry.name;
+				double ns = t / iters * 1e9;
+				printf("%-32s %15.0f %12llu\n", name.c_str(), ns, iters);
+				json += strfmt(
+					"%s\n  {\"name\": \"%s\", \"arg\": %lld, \"iterations\": %llu, \"ns_per_iter\": %.1f}",
+					n++ ? "," : "", entry.name.c_str(), value, iters, ns
+				);
+			}
+		}
+		json += "\n]\n";
+		
+		if (!output.empty()) {
+			std::ofstream out(output);
+			out << json;
+			if (!out)
+				throw std::runtime_error("Couldn't write " + output.string());
+		}
+		return EXIT_SUCCESS;
+	}
+	catch (std::exception& e) {
+		log.critical(e.what());
+	}
+	return EXIT_FAILURE;
+}
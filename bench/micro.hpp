@@ -0,0 +1,58 @@
+#ifndef ICEMET_BENCH_MICRO_H
+#define ICEMET_BENCH_MICRO_H
+
+#include "icemet/core/config.hpp"
+#include "icemet/util/time.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Timing loop of one benchmark run. The body is repeated while run()
+// returns true and the harness grows the iteration count until the run
+// takes long enough to be measured.
+class MicroState {
+private:
+	long long m_arg;
+	unsigned long long m_iters;
+	unsigned long long m_left;
+	double m_time;
+	chr::steady_clock::time_point m_start;
+	bool m_started;
+	chr::steady_clock::time_point m_pause;
+
+public:
+	MicroState(long long arg, unsigned long long iters);
+	
+	long long arg() const { return m_arg; }
+	unsigned long long iterations() const { return m_iters; }
+	double time() const { return m_time; }
+	
+	bool run();
+	void pause();
+	void resume();
+};
+
+typedef std::function<void(MicroState&)> MicroFunc;
+typedef std::function<std::vector<long long>(const Config&)> MicroArgs;
+
+// Registry of the benchmarks
+class Micro {
+public:
+	Micro(const char* name, MicroFunc func, MicroArgs args=MicroArgs());
+	
+	// Config given on the command line
+	static const Config& config();
+};
+
+// Keeps the compiler from removing a computation whose result is unused
+template<class T>
+inline void microUse(const T& val)
+{
+	asm volatile("" : : "m"(val) : "memory");
+}
+
+#define MICRO(name) static Micro micro_##name(#name, name)
+#define MICRO_ARGS(name, ...) static Micro micro_##name(#name, name, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,107 @@
+#include "synth.hpp"
+
+#include <opencv2/icemet.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#define SYNTH_TILE 512
+#define SYNTH_BACKGROUND 128.0
+#define SYNTH_NOISE 2.0
+
+Synth::Synth(const Config* cfg, uint64 seed) :
+	m_cfg(cfg),
+	m_rng(seed),
+	m_size(cfg->img.rect.x + cfg->img.rect.width, cfg->img.rect.y + cfg->img.rect.height),
+	m_tile(std::min(SYNTH_TILE, cv::getOptimalDFTSize(std::max(m_size.width, m_size.height)))) {}
+
+void Synth::propagate(const SynthParticle& par, cv::Mat& field)
+{
+	// A diverging beam is equivalent to a collimated one with the droplet
+	// magnified and moved to M*z
+	double M = cv::icemet::Hologram::magnf(m_cfg->hologram.dist, par.z);
+	double psz = m_cfg->hologram.psz;
+	double lambda = m_cfg->hologram.lambda;
+	double z = M * par.z;
+	double r = 0.5 * M * par.diam / psz;
+	
+	// Absorption of the droplet centered in the tile
+	int n = m_tile;
+	double cx = n / 2 + (par.x - std::floor(par.x));
+	double cy = n / 2 + (par.y - std::floor(par.y));
+	cv::Mat tile(n, n, CV_32FC2, cv::Scalar::all(0));
+	for (int y = std::max(0, (int)(cy-r-1)); y <= std::min(n-1, (int)(cy+r+1)); y++) {
+		cv::Vec2f* row = tile.ptr<cv::Vec2f>(y);
+		for (int x = std::max(0, (int)(cx-r-1)); x <= std::min(n-1, (int)(cx+r+1)); x++) {
+			if ((x-cx)*(x-cx) + (y-cy)*(y-cy) <= r*r)
+				row[x][0] = -1.0;
+		}
+	}
+	
+	// Angular spectrum transfer function. Frequencies that would leave the
+	// tile before reaching the sensor are dropped.
+	cv::dft(tile, tile, cv::DFT_COMPLEX_OUTPUT);
+	double df = 1.0 / (n * psz);
+	double fMax = 0.5 * n * psz / std::sqrt(z*z + 0.25 * n*n * psz*psz) / lambda;
+	for (int v = 0; v < n; v++) {
+		double fy = (v < n/2 ? v : v - n) * df;
+		cv::Vec2f* row = tile.ptr<cv::Vec2f>(v);
+		for (int u = 0; u < n; u++) {
+			double fx = (u < n/2 ? u : u - n) * df;
+			double f2 = fx*fx + fy*fy;
+			if (f2 > fMax*fMax) {
+				row[u] = cv::Vec2f(0, 0);
+				continue;
+			}
+			double phase = 2.0 * CV_PI * z * std::sqrt(1.0/(lambda*lambda) - f2);
+			float c = std::cos(phase), s = std::sin(phase);
+			float re = row[u][0], im = row[u][1];
+			row[u] = cv::Vec2f(re*c - im*s, re*s + im*c);
+		}
+	}
+	cv::idft(tile, tile, cv::DFT_SCALE);
+	
+	// Add to the frame field
+	cv::Rect dst((int)std::floor(par.x) - n/2, (int)std::floor(par.y) - n/2, n, n);
+	cv::Rect clip = dst & cv::Rect(0, 0, field.cols, field.rows);
+	if (clip.empty())
+		return;
+	cv::Mat roi = field(clip);
+	roi += tile(clip - dst.tl());
+}
+
+void Synth::generate(int n, cv::Mat& dst, std::vector<SynthParticle>& particles)
+{
+	// Droplets inside the analysed area and counted range
+	const ImageParam& img = m_cfg->img;
+	const ParticleParam& p = m_cfg->particle;
+	cv::Rect area(
+		img.rect.x + img.border.width, img.rect.y + img.border.height,
+		img.rect.width - 2*img.border.width, img.rect.height - 2*img.border.height
+	);
+	particles.clear();
+	for (int i = 0; i < n; i++) {
+		particles.push_back({
+			(float)m_rng.uniform((double)area.x, (double)area.x + area.width),
+			(float)m_rng.uniform((double)area.y, (double)area.y + area.height),
+			(float)m_rng.uniform((double)p.zMin, (double)p.zMax),
+			(float)m_rng.uniform((double)std::max(p.diamMin, 4*m_cfg->hologram.psz), (double)std::min(p.diamMax, 50*m_cfg->hologram.psz))
+		});
+	}
+	
+	// Unit plane wave plus the scattered fields
+	cv::Mat field(m_size, CV_32FC2, cv::Scalar(1, 0));
+	for (const auto& par : particles)
+		propagate(par, field);
+	
+	// Intensity with sensor noise
+	cv::Mat planes[2];
+	cv::split(field, planes);
+	cv::Mat intensity;
+	cv::magnitude(planes[0], planes[1], intensity);
+	cv::multiply(intensity, intensity, intensity, SYNTH_BACKGROUND);
+	cv::Mat noise(m_size, CV_32FC1);
+	m_rng.fill(noise, cv::RNG::NORMAL, 0.0, SYNTH_NOISE);
+	intensity += noise;
+	intensity.convertTo(dst, CV_8UC1);
+}
@@ -0,0 +1,35 @@
+#ifndef ICEMET_BENCH_SYNTH_H
+#define ICEMET_BENCH_SYNTH_H
+
+#include "icemet/core/config.hpp"
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+typedef struct _synth_particle {
+	float x, y; // Frame coordinates (px)
+	float z;
+	float diam;
+} SynthParticle;
+
+// Deterministic in-line holograms of opaque droplets. Every droplet is
+// propagated with the angular spectrum method in its own tile and the fields
+// are summed, so overlapping fringes interfere like in a real hologram.
+class Synth {
+private:
+	const Config* m_cfg;
+	cv::RNG m_rng;
+	cv::Size2i m_size;
+	int m_tile;
+	
+	void propagate(const SynthParticle& par, cv::Mat& field);
+
+public:
+	Synth(const Config* cfg, uint64 seed=0x1ce3e7);
+	
+	cv::Size2i size() const { return m_size; }
+	void generate(int n, cv::Mat& dst, std::vector<SynthParticle>& particles);
+};
+
+#endif
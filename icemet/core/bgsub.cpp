@@ -0,0 +1,133 @@
+#include "bgsub.hpp"
+
+#include <opencv2/core/utility.hpp>
+
+#include <algorithm>
+
+#define TILE_ROWS 32
+
+MedianStack::MedianStack(const cv::Size2i& size, int len) :
+	m_size(size),
+	m_len(len),
+	m_count(0),
+	m_head(0)
+{
+	for (int i = 0; i < m_len; i++) {
+		m_frames.push_back(cv::Mat::zeros(m_size, CV_8UC1));
+		m_sorted.push_back(cv::Mat::zeros(m_size, CV_8UC1));
+	}
+	m_new = cv::Mat(m_size, CV_8UC1);
+	const int ntiles = (m_size.height + TILE_ROWS - 1) / TILE_ROWS;
+	m_sums.resize(ntiles);
+	m_passed = cv::Mat(ntiles, m_size.width, CV_8UC1);
+	m_ranks.resize(ntiles * m_len);
+}
+
+void MedianStack::update(const cv::Range& rows)
+{
+	const int w = m_size.width;
+	const bool isFull = full();
+	const int n = isFull ? m_len-1 : m_count; // Values left after removal
+	const int tile = rows.start / TILE_ROWS;
+	unsigned char* passed = m_passed.ptr<unsigned char>(tile);
+	unsigned char** s = &m_ranks[tile * m_len];
+	
+	for (int y = rows.start; y < rows.end; y++) {
+		const unsigned char* oldRow = m_frames[m_head].ptr<unsigned char>(y);
+		const unsigned char* newRow = m_new.ptr<unsigned char>(y);
+		for (int k = 0; k < m_len; k++)
+			s[k] = m_sorted[k].ptr<unsigned char>(y);
+		
+		// Remove the oldest value by shifting the larger ones down
+		if (isFull) {
+			std::fill(passed, passed + w, 0);
+			for (int k = 0; k < m_len-1; k++) {
+				unsigned char* sk = s[k];
+				const unsigned char* sk1 = s[k+1];
+				for (int x = 0; x < w; x++) {
+					passed[x] |= sk[x] == oldRow[x];
+					sk[x] = passed[x] ? sk1[x] : sk[x];
+				}
+			}
+		}
+		
+		// Insert the newest value. Going downwards, every rank is the new
+		// value clamped between its lower and upper neighbour.
+		for (int k = n; k >= 0; k--) {
+			unsigned char* sk = s[k];
+			const unsigned char* lo = k > 0 ? s[k-1] : NULL;
+			const bool hasHi = k < n;
+			for (int x = 0; x < w; x++) {
+				unsigned char v = hasHi ? std::min(newRow[x], sk[x]) : newRow[x];
+				sk[x] = lo ? std::max(lo[x], v) : v;
+			}
+		}
+	}
+	
+	// Sum of the median for the division scale
+	if (m_count+1 >= m_len) {
+		double sum = 0.0;
+		const cv::Mat& med = m_sorted[m_len/2];
+		for (int y = rows.start; y < rows.end; y++) {
+			const unsigned char* row = med.ptr<unsigned char>(y);
+			int rowSum = 0;
+			for (int x = 0; x < w; x++)
+				rowSum += row[x];
+			sum += rowSum;
+		}
+		m_sums[tile] = sum;
+	}
+}
+
+bool MedianStack::push(const cv::UMat& img)
+{
+	CV_Assert(img.size() == m_size && img.type() == CV_8UC1);
+	img.copyTo(m_new);
+	
+	// Update row tiles in parallel
+	const int ntiles = m_sums.size();
+	cv::parallel_for_(cv::Range(0, ntiles), [&](const cv::Range& range) {
+		for (int i = range.start; i < range.end; i++) {
+			int y0 = i * TILE_ROWS;
+			update(cv::Range(y0, std::min(y0+TILE_ROWS, m_size.height)));
+		}
+	});
+	
+	// The newest frame replaces the oldest one in the ring
+	std::swap(m_frames[m_head], m_new);
+	m_head = (m_head + 1) % m_len;
+	if (m_count < m_len)
+		m_count++;
+	return full();
+}
+
+void MedianStack::median(cv::Mat& dst) const
+{
+	m_sorted[m_len/2].copyTo(dst);
+}
+
+void MedianStack::meddiv(cv::UMat& dst) const
+{
+	CV_Assert(full());
+	
+	// The center frame of the window is divided by the median and scaled
+	// back to the mean background level
+	const cv::Mat& center = m_frames[(m_head + m_len - 1 - m_len/2) % m_len];
+	const cv::Mat& med = m_sorted[m_len/2];
+	double sum = 0.0;
+	for (double s : m_sums)
+		sum += s;
+	const float scale = sum / m_size.area();
+	
+	dst.create(m_size, CV_8UC1);
+	cv::Mat out = dst.getMat(cv::ACCESS_WRITE);
+	cv::parallel_for_(cv::Range(0, m_size.height), [&](const cv::Range& range) {
+		for (int y = range.start; y < range.end; y++) {
+			const unsigned char* c = center.ptr<unsigned char>(y);
+			const unsigned char* m = med.ptr<unsigned char>(y);
+			unsigned char* d = out.ptr<unsigned char>(y);
+			for (int x = 0; x < m_size.width; x++)
+				d[x] = cv::saturate_cast<unsigned char>(c[x] * scale / std::max<int>(m[x], 1));
+		}
+	});
+}
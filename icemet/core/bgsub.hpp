@@ -0,0 +1,36 @@
+#ifndef ICEMET_BGSUB_H
+#define ICEMET_BGSUB_H
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+// Background subtraction stack that keeps the values of every pixel sorted
+// over the window. Each push removes the oldest frame and inserts the newest
+// one, so the median is updated in O(len) per pixel instead of being
+// recomputed from the whole stack.
+class MedianStack {
+private:
+	cv::Size2i m_size;
+	int m_len;
+	int m_count;
+	int m_head;
+	std::vector<cv::Mat> m_frames; // Ring of the frames in the window
+	std::vector<cv::Mat> m_sorted; // Sorted pixel values, one plane per rank
+	cv::Mat m_new;
+	std::vector<double> m_sums; // Median sums of each tile
+	cv::Mat m_passed; // Removal flags, one row per tile
+	std::vector<unsigned char*> m_ranks; // Rank row pointers, m_len per tile
+	
+	void update(const cv::Range& rows);
+
+public:
+	MedianStack(const cv::Size2i& size, int len);
+	
+	bool full() const { return m_count >= m_len; }
+	bool push(const cv::UMat& img);
+	void median(cv::Mat& dst) const;
+	void meddiv(cv::UMat& dst) const;
+};
+
+#endif
@@ -4,7 +4,14 @@
 
 #include <yaml-cpp/yaml.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <stdexcept>
 
 Config::Config(const Arguments& args) : args(args)
@@ -21,6 +28,7 @@ Config::Config(const Config& cfg) :
 	args(cfg.args),
 	paths(cfg.paths),
 	saves(cfg.saves),
+	keeps(cfg.keeps),
 	types(cfg.types),
 	connInfo(cfg.connInfo),
 	dbInfo(cfg.dbInfo),
@@ -28,11 +36,18 @@ Config::Config(const Config& cfg) :
 	bgsub(cfg.bgsub),
 	emptyCheck(cfg.emptyCheck),
 	noisyCheck(cfg.noisyCheck),
+	proxy(cfg.proxy),
 	lpf(cfg.lpf),
 	hologram(cfg.hologram),
 	segment(cfg.segment),
 	particle(cfg.particle),
 	diamCorr(cfg.diamCorr),
+	stats(cfg.stats),
+	metrics(cfg.metrics),
+	state(cfg.state),
+	realtime(cfg.realtime),
+	pipeline(cfg.pipeline),
+	reload(cfg.reload),
 	ocl(cfg.ocl) {}
 
 fs::path Config::strToPath(const std::string& str) const
@@ -42,6 +57,32 @@ fs::path Config::strToPath(const std::string& str) const
 	return p;
 }
 
+static void loadStage(const YAML::Node& node, const char* name, StageParam& stage, int queue, bool replicable)
+{
+	stage.replicas = 1;
+	stage.queue = queue;
+	stage.affinity.clear();
+	stage.affinityAuto = false;
+	if (node && node[name]) {
+		const YAML::Node stageNode = node[name];
+		stage.replicas = stageNode["replicas"].as<int>(1);
+		stage.queue = stageNode["queue"].as<int>(queue);
+		const YAML::Node affinity = stageNode["affinity"];
+		if (affinity && affinity.IsScalar()) {
+			if (affinity.as<std::string>() != "auto")
+				throw std::runtime_error(strfmt("Invalid affinity for stage '%s'", name));
+			stage.affinityAuto = true;
+		}
+		else {
+			stage.affinity = affinity.as<std::vector<int>>(std::vector<int>());
+		}
+	}
+	if (stage.replicas < 1 || (!replicable && stage.replicas > 1))
+		throw std::runtime_error(strfmt("Invalid replica count for stage '%s'", name));
+	if (stage.queue < 1)
+		throw std::runtime_error(strfmt("Invalid queue size for stage '%s'", name));
+}
+
 void Config::load(const fs::path& fn)
 {
 	try {
@@ -73,6 +114,10 @@ void Config::load(const fs::path& fn)
 		saves.empty = node["save_empty"].as<bool>();
 		saves.skipped = node["save_skipped"].as<bool>();
 		
+		keeps.preproc = saves.preproc;
+		keeps.segments = saves.recon || saves.preview;
+		keeps.particles = saves.threshold;
+		
 		types.results = strToPath(node["type_results"].as<std::string>());
 		types.lossy = strToPath(node["type_results_lossy"].as<std::string>());
 		
@@ -88,6 +133,7 @@ void Config::load(const fs::path& fn)
 		
 		bgsub.enabled = node["bgsub"].as<bool>();
 		bgsub.stackLen = node["bgsub_stack_len"].as<int>();
+		bgsub.incremental = node["bgsub_incremental"].as<bool>(false);
 		
 		emptyCheck.originalTh = node["empty_th_original"].as<int>();
 		emptyCheck.preprocTh = node["empty_th_preproc"].as<int>();
@@ -95,6 +141,13 @@ void Config::load(const fs::path& fn)
 		
 		noisyCheck.contours = node["noisy_contours"].as<int>();
 		
+		proxy.binning = node["proxy_binning"].as<int>(1);
+		if (proxy.binning != 1 && proxy.binning != 2 && proxy.binning != 4)
+			throw std::runtime_error(strfmt("Invalid proxy_binning %d, expected 1, 2 or 4", proxy.binning));
+		proxy.emptyTh = node["proxy_empty_th"].as<int>(emptyCheck.reconTh);
+		proxy.contours = node["proxy_noisy_contours"].as<int>(noisyCheck.contours);
+		proxy.verify = node["proxy_verify"].as<int>(0);
+		
 		lpf.enabled = node["filt_lowpass"].as<bool>();
 		lpf.f = node["filt_lowpass_f"].as<float>();
 		
@@ -105,17 +158,22 @@ void Config::load(const fs::path& fn)
 		hologram.lambda = node["holo_lambda"].as<float>();
 		hologram.dist = node["holo_collimated"].as<bool>() ? 0.0 : node["holo_distance"].as<float>();
 		hologram.step = node["recon_step"].as<int>();
+		hologram.limitZ = node["recon_limit_z"].as<bool>(false);
+		hologram.zMargin = node["recon_z_margin"].as<float>(1.0e-3);
 		hologram.focusK = node["focus_k"].as<float>();
+		hologram.focusIntegral = node["focus_integral"].as<bool>(false);
 		
 		segment.thFact = node["segment_th_factor"].as<float>();
 		segment.sizeMin = node["segment_size_min"].as<int>();
 		segment.sizeMax = node["segment_size_max"].as<int>();
 		segment.sizeSmall = node["segment_size_small"].as<int>();
 		segment.pad = node["segment_pad"].as<int>();
+		segment.merge = node["segment_merge"].as<bool>(false);
 		
 		particle.zMin = node["particle_z_min"].as<float>();
 		particle.zMax = node["particle_z_max"].as<float>();
 		particle.thFact = node["particle_th_factor"].as<float>();
+		particle.labels = node["particle_labels"].as<bool>(false);
 		particle.diamMin = node["particle_diam_min"].as<float>();
 		particle.diamMax = node["particle_diam_max"].as<float>();
 		particle.diamStep = node["particle_diam_step"].as<float>();
@@ -124,6 +182,19 @@ void Config::load(const fs::path& fn)
 		particle.dynRangeMin = node["particle_dnr_min"].as<int>();
 		particle.dynRangeMax = node["particle_dnr_max"].as<int>();
 		
+		// The limited z-range can't be empty. A reload is rejected as well,
+		// so the running range is kept.
+		if (hologram.limitZ) {
+			float start = particle.zMin - hologram.zMargin;
+			float stop = particle.zMax + hologram.zMargin;
+			if (start > stop || start >= hologram.z.stop || stop <= hologram.z.start) {
+				throw std::runtime_error(strfmt(
+					"Particle z-range %.2f-%.2f mm is outside holo_z %.2f-%.2f mm",
+					start*1e3, stop*1e3, hologram.z.start*1e3, hologram.z.stop*1e3
+				));
+			}
+		}
+		
 		diamCorr.enabled = node["diam_correction"].as<bool>();
 		diamCorr.D0 = node["diam_correction_start"].as<float>();
 		diamCorr.D1 = node["diam_correction_end"].as<float>();
@@ -133,9 +204,153 @@ void Config::load(const fs::path& fn)
 		stats.time = node["stats_time"].as<int>();
 		stats.frames = node["stats_frames"].as<int>();
 		
+		std::string metricsFile = node["metrics_file"].as<std::string>("");
+		metrics.file = metricsFile.empty() ? fs::path() : strToPath(metricsFile);
+		metrics.port = node["metrics_port"].as<int>(0);
+		metrics.interval = node["metrics_interval"].as<float>(10.0);
+		std::string traceFile = node["trace_file"].as<std::string>("");
+		metrics.trace = traceFile.empty() ? fs::path() : strToPath(traceFile);
+		
+		std::string stateDir = node["state_dir"].as<std::string>("");
+		state.dir = stateDir.empty() ? fs::path() : strToPath(stateDir);
+		
+		realtime.enabled = node["realtime"].as<bool>(false);
+		realtime.interval = node["realtime_interval"].as<float>(1.0);
+		realtime.backlog = node["realtime_backlog"].as<int>(20);
+		realtime.lag = node["realtime_lag"].as<float>(10.0);
+		realtime.hold = node["realtime_hold"].as<float>(30.0);
+		realtime.zFactor = node["realtime_z_factor"].as<float>(2.0);
+		if (realtime.enabled && (realtime.interval <= 0.0 || realtime.zFactor < 1.0))
+			throw std::runtime_error("Invalid realtime_interval or realtime_z_factor");
+		
+		// Stages that keep state between frames run in a single thread
+		static const char* stages[] = {"watcher", "reader", "preproc", "recon", "analysis", "saver", "stats"};
+		const YAML::Node pipelineNode = node["pipeline"];
+		if (pipelineNode) {
+			for (const auto& it : pipelineNode) {
+				std::string name = it.first.as<std::string>();
+				if (std::find(std::begin(stages), std::end(stages), name) == std::end(stages))
+					throw std::runtime_error(strfmt("Unknown stage '%s'", name.c_str()));
+			}
+		}
+		loadStage(pipelineNode, "watcher", pipeline.watcher, 1, false);
+		loadStage(pipelineNode, "reader", pipeline.reader, 1, false);
+		loadStage(pipelineNode, "preproc", pipeline.preproc, 4, false);
+		loadStage(pipelineNode, "recon", pipeline.recon, 2, true);
+		loadStage(pipelineNode, "analysis", pipeline.analysis, 2, true);
+		loadStage(pipelineNode, "saver", pipeline.saver, 2, true);
+		loadStage(pipelineNode, "stats", pipeline.stats, 2, false);
+		
+		reload.watch = node["config_watch"].as<bool>(false);
+		
 		ocl.device = node["ocl_device"].as<std::string>();
+		std::string oclCache = node["ocl_cache"].as<std::string>("");
+		ocl.cache = oclCache.empty() ? fs::path() : strToPath(oclCache);
 	}
 	catch (std::exception& e) {
 		throw(std::runtime_error(strfmt("Couldn't parse config file: ") + e.what()));
 	}
 }
+
+// Keys whose parameters the stages pick up between frames
+static const char* reloadable[] = {
+	"empty_th_", "noisy_contours", "proxy_", "filt_lowpass",
+	"holo_", "recon_step", "recon_limit_z", "recon_z_margin", "focus_",
+	"segment_", "particle_", "diam_correction"
+};
+
+static Log storeLog("CONFIG");
+static std::mutex storeMutex;
+// A stage may use the previous version until its current frame is done,
+// and Stats until its window closes, so none is freed. Only reloads that
+// change a reloadable key add a copy of a few kilobytes.
+static std::vector<std::unique_ptr<Config>> storeVersions;
+static Config* storeCurrent = NULL;
+static std::atomic<unsigned int> storeVersion(0);
+static YAML::Node storeNode; // File as applied to the current version
+
+static std::string storeDump(const YAML::Node& node, const std::string& key)
+{
+	const YAML::Node val = node[key];
+	return val ? YAML::Dump(val) : std::string();
+}
+
+void ConfigStore::start(Config* cfg)
+{
+	std::lock_guard<std::mutex> lock(storeMutex);
+	storeCurrent = cfg;
+	storeNode = YAML::LoadFile(cfg->args.cfgFile.string());
+}
+
+unsigned int ConfigStore::version()
+{
+	return storeVersion;
+}
+
+Config* ConfigStore::get()
+{
+	std::lock_guard<std::mutex> lock(storeMutex);
+	return storeCurrent;
+}
+
+bool ConfigStore::reload()
+{
+	std::lock_guard<std::mutex> lock(storeMutex);
+	if (!storeCurrent)
+		return false;
+	
+	// Parse and validate the whole file before anything is published
+	YAML::Node node;
+	Config loaded;
+	try {
+		node = YAML::LoadFile(storeCurrent->args.cfgFile.string());
+		loaded.load(storeCurrent->args.cfgFile);
+	}
+	catch (std::exception& e) {
+		storeLog.error("Reload failed: %s", e.what());
+		return false;
+	}
+	
+	// Compare to the file as applied. Keys that need a restart keep their
+	// running values, so they are reported again on every reload.
+	std::set<std::string> keys;
+	for (const auto& it : storeNode)
+		keys.insert(it.first.as<std::string>());
+	for (const auto& it : node)
+		keys.insert(it.first.as<std::string>());
+	std::string changed;
+	for (const auto& key : keys) {
+		if (storeDump(storeNode, key) == storeDump(node, key))
+			continue;
+		bool ok = std::any_of(std::begin(reloadable), std::end(reloadable), [&](const char* prefix) {
+			return key.compare(0, strlen(prefix), prefix) == 0;
+		});
+		if (!ok) {
+			storeLog.warning("'%s' changed, restart to apply it", key.c_str());
+			continue;
+		}
+		changed += (changed.empty() ? "" : ", ") + key;
+		if (node[key])
+			storeNode[key] = YAML::Clone(node[key]);
+		else
+			storeNode.remove(key);
+	}
+	if (changed.empty()) {
+		storeLog.info("Nothing to reload");
+		return false;
+	}
+	
+	std::unique_ptr<Config> cfg(new Config(*storeCurrent));
+	cfg->emptyCheck = loaded.emptyCheck;
+	cfg->noisyCheck = loaded.noisyCheck;
+	cfg->proxy = loaded.proxy;
+	cfg->lpf = loaded.lpf;
+	cfg->hologram = loaded.hologram;
+	cfg->segment = loaded.segment;
+	cfg->particle = loaded.particle;
+	cfg->diamCorr = loaded.diamCorr;
+	storeCurrent = cfg.get();
+	storeVersions.push_back(std::move(cfg));
+	storeLog.info("Version %u: %s", ++storeVersion, changed.c_str());
+	return true;
+}
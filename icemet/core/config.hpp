@@ -9,15 +9,17 @@
 #include <opencv2/icemet.hpp>
 
 #include <string>
+#include <vector>
 
 typedef struct _arguments {
 	fs::path cfgFile;
 	fs::path root;
 	bool waitNew;
 	bool statsOnly;
+	int shards; // Parallel pipelines over the watched files
 	LogLevel loglevel;
 	
-	_arguments() : cfgFile(fs::path()), root(fs::path(".")), waitNew(true), statsOnly(false), loglevel(LOG_INFO) {}
+	_arguments() : cfgFile(fs::path()), root(fs::path(".")), waitNew(true), statsOnly(false), shards(1), loglevel(LOG_INFO) {}
 } Arguments;
 
 typedef struct _paths {
@@ -40,6 +42,12 @@ typedef struct _saves {
 	bool skipped;
 } Saves;
 
+typedef struct _keeps {
+	bool preproc; // Preprocessed image is needed after reconstruction
+	bool segments; // Segment images are needed after analysis
+	bool particles; // Particle images are needed after analysis
+} Keeps;
+
 typedef struct _types {
 	fs::path results;
 	fs::path lossy;
@@ -55,6 +63,7 @@ typedef struct _image_param {
 typedef struct _bgsub_param {
 	bool enabled;
 	int stackLen;
+	bool incremental;
 } BGSubParam;
 
 typedef struct _empty_check_param {
@@ -67,6 +76,13 @@ typedef struct _noisy_check_param {
 	int contours;
 } NoisyCheckParam;
 
+typedef struct _proxy_param {
+	int binning;
+	int emptyTh; // Empty check threshold of the binned image
+	int contours; // Noisy check contours of the binned image
+	int verify;
+} ProxyParam;
+
 typedef struct _filter_param {
 	bool enabled;
 	float f;
@@ -79,6 +95,9 @@ typedef struct _hologram_param {
 	float lambda;
 	int step;
 	float focusK;
+	bool focusIntegral; // Score FOCUS_STD segments from per-plane integral images
+	bool limitZ; // Reconstruct only the particle z-range plus margin
+	float zMargin;
 } HologramParam;
 
 typedef struct _segment_param {
@@ -88,10 +107,12 @@ typedef struct _segment_param {
 	int sizeMax;
 	int sizeSmall;
 	int pad;
+	bool merge; // Skip detections already focused inside an earlier z-chunk
 } SegmentParam;
 
 typedef struct _particle_param {
 	float thFact;
+	bool labels; // Measure with run-length labeling instead of contours
 	float zMin;
 	float zMax;
 	float diamMin;
@@ -116,8 +137,50 @@ typedef struct _stats_param {
 	int frames;
 } StatsParam;
 
+typedef struct _metrics_param {
+	fs::path file; // Prometheus text file, empty to disable
+	int port; // Local HTTP port, 0 to disable
+	float interval;
+	fs::path trace; // Chrome trace-event file, empty to disable
+} MetricsParam;
+
+typedef struct _state_param {
+	fs::path dir; // Checkpoint directory, empty to disable
+} StateParam;
+
+typedef struct _realtime_param {
+	bool enabled;
+	float interval; // Target frame interval (s)
+	int backlog; // Unread frames before degrading
+	float lag; // Frame age at reconstruction before degrading (s)
+	float hold; // Minimum time between mode changes (s)
+	float zFactor; // Reconstruction z-step multiplier when degraded
+} RealtimeParam;
+
+typedef struct _stage_param {
+	int replicas; // Worker threads running the stage
+	int queue; // Capacity of the input queue
+	std::vector<int> affinity; // Allowed CPU cores, empty for any
+	bool affinityAuto; // Replica n on the CPUs of NUMA node n mod nodes
+} StageParam;
+
+typedef struct _pipeline_param {
+	StageParam watcher;
+	StageParam reader;
+	StageParam preproc;
+	StageParam recon;
+	StageParam analysis;
+	StageParam saver;
+	StageParam stats;
+} PipelineParam;
+
+typedef struct _reload_param {
+	bool watch; // Reload when the file is modified
+} ReloadParam;
+
 typedef struct _ocl_param {
 	std::string device;
+	fs::path cache; // Compiled program binaries, empty for the OpenCV default
 } OCLParam;
 
 class Config {
@@ -135,6 +198,7 @@ public:
 	Arguments args;
 	Paths paths;
 	Saves saves;
+	Keeps keeps;
 	Types types;
 	ConnectionInfo connInfo;
 	DatabaseInfo dbInfo;
@@ -142,13 +206,31 @@ public:
 	BGSubParam bgsub;
 	EmptyCheckParam emptyCheck;
 	NoisyCheckParam noisyCheck;
+	ProxyParam proxy;
 	FilterParam lpf;
 	HologramParam hologram;
 	SegmentParam segment;
 	ParticleParam particle;
 	DiameterCorrection diamCorr;
 	StatsParam stats;
+	MetricsParam metrics;
+	StateParam state;
+	RealtimeParam realtime;
+	PipelineParam pipeline;
+	ReloadParam reload;
 	OCLParam ocl;
 };
 
+// Published versions of the configuration. A reload parses the file again
+// and publishes a copy of the current version with the parameters that can
+// change between frames. Earlier versions are kept for the workers still
+// using them.
+class ConfigStore {
+public:
+	static void start(Config* cfg);
+	static unsigned int version();
+	static Config* get();
+	static bool reload();
+};
+
 #endif
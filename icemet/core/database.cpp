@@ -8,6 +8,8 @@
 #define FLOAT_REPR "%.24f"
 #define MAX_ROWS "1000"
 
+static Log databaseLog("SQL");
+
 static const char* createDBQuery = "CREATE DATABASE `%s`;";
 static const char* createParticleTableQuery = "CREATE TABLE `%s` ("
 "ID INT UNSIGNED NOT NULL AUTO_INCREMENT,"
@@ -27,7 +29,8 @@ static const char* createParticleTableQuery = "CREATE TABLE `%s` ("
 "SubY INT UNSIGNED NOT NULL,"
 "SubW INT UNSIGNED NOT NULL,"
 "SubH INT UNSIGNED NOT NULL,"
-"PRIMARY KEY (ID)"
+"PRIMARY KEY (ID),"
+"UNIQUE KEY FrameParticle (DateTime, Sensor, Frame, Particle)"
 ");";
 static const char* createStatsTableQuery = "CREATE TABLE `%s` ("
 "ID INT UNSIGNED NOT NULL AUTO_INCREMENT,"
@@ -43,7 +46,7 @@ static const char* insertParticleQuery = "INSERT INTO `%s` ("
 "ID, DateTime, Sensor, Frame, Particle, X, Y, Z, EquivDiam, EquivDiamCorr, Circularity, DynRange, EffPxSz, SubX, SubY, SubW, SubH"
 ")VALUES("
 "NULL, '%s', %u, %u, %u, " FLOAT_REPR ", " FLOAT_REPR ", " FLOAT_REPR ", " FLOAT_REPR ", " FLOAT_REPR ", " FLOAT_REPR ", %u, " FLOAT_REPR ", %u, %u, %u, %u"
-");";
+")ON DUPLICATE KEY UPDATE ID=ID;";
 static const char* insertStatsQuery = "INSERT INTO `%s` ("
 "ID, DateTime, LWC, MVD, Conc, Frames, Particles"
 ")VALUES("
@@ -122,6 +125,16 @@ bool Database::tableExists(const char* table)
 	return ret;
 }
 
+bool Database::indexExists(const char* table, const char* index)
+{
+	MYSQL_RES* res = NULL;
+	if (!(res = queryRes("SHOW INDEX FROM `%s` WHERE Key_name=\"%s\"", table, index)))
+		return false;
+	bool ret = mysql_num_rows(res);
+	mysql_free_result(res);
+	return ret;
+}
+
 void Database::connect(const ConnectionInfo& connInfo)
 {
 	if (!(m_mysql = mysql_init(NULL)))
@@ -148,9 +161,12 @@ void Database::open(const DatabaseInfo& dbInfo)
 		mysql_select_db(m_mysql, dbInfo.name.c_str());
 	}
 	
-	// Make sure that tables exist
+	// Make sure that tables exist. Particles of a frame that is redone after
+	// a restart are written only once thanks to the unique key.
 	if (!tableExists(dbInfo.particleTable.c_str()))
 		query(createParticleTableQuery, dbInfo.particleTable.c_str());
+	else if (!indexExists(dbInfo.particleTable.c_str(), "FrameParticle"))
+		databaseLog.warning("Table '%s' has no FrameParticle key, frames redone after a restart may duplicate particles", dbInfo.particleTable.c_str());
 	if (!tableExists(dbInfo.statsTable.c_str()))
 		query(createStatsTableQuery, dbInfo.statsTable.c_str());
 	
@@ -159,13 +175,14 @@ void Database::open(const DatabaseInfo& dbInfo)
 
 void Database::close()
 {
-	mysql_close(m_mysql);
+	if (m_mysql)
+		mysql_close(m_mysql);
 	m_mysql = NULL;
 }
 
-void Database::writeParticle(const ParticleRow& row)
+std::string Database::particleQuery(const ParticleRow& row) const
 {
-	query(
+	return strfmt(
 		insertParticleQuery, m_dbInfo.particleTable.c_str(),
 		row.dt.str().c_str(),
 		row.sensor, row.frame, row.particle,
@@ -176,9 +193,9 @@ void Database::writeParticle(const ParticleRow& row)
 	);
 }
 
-void Database::writeStats(const StatsRow& row)
+std::string Database::statsQuery(const StatsRow& row) const
 {
-	query(
+	return strfmt(
 		insertStatsQuery, m_dbInfo.statsTable.c_str(),
 		row.dt.str().c_str(),
 		row.lwc, row.mvd, row.conc,
@@ -186,6 +203,16 @@ void Database::writeStats(const StatsRow& row)
 	);
 }
 
+void Database::writeParticle(const ParticleRow& row)
+{
+	query("%s", particleQuery(row).c_str());
+}
+
+void Database::writeStats(const StatsRow& row)
+{
+	query("%s", statsQuery(row).c_str());
+}
+
 /* TODO: mysql_free_result() in case of failure */
 void Database::readParticles(std::vector<ParticleRow>& rows, unsigned int minId)
 {
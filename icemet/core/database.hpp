@@ -61,11 +61,12 @@ private:
 	void query(const char *fmt, ...);
 	MYSQL_RES* queryRes(const char *fmt, ...);
 	bool tableExists(const char *table);
+	bool indexExists(const char *table, const char *index);
 
 public:
 	Database();
 	Database(const ConnectionInfo& connInfo, const DatabaseInfo& dbInfo);
-	~Database();
+	virtual ~Database();
 	
 	void connect(const ConnectionInfo& connInfo);
 	void open(const DatabaseInfo& dbInfo);
@@ -74,10 +75,12 @@ public:
 	void lock() { m_mutex.lock(); }
 	void unlock() { m_mutex.unlock(); }
 	
-	void writeParticle(const ParticleRow& row);
-	void writeStats(const StatsRow& row);
+	std::string particleQuery(const ParticleRow& row) const;
+	std::string statsQuery(const StatsRow& row) const;
+	virtual void writeParticle(const ParticleRow& row);
+	virtual void writeStats(const StatsRow& row);
 	
-	void readParticles(std::vector<ParticleRow>& rows, unsigned int minId=0);
+	virtual void readParticles(std::vector<ParticleRow>& rows, unsigned int minId=0);
 };
 
 #endif
@@ -1,5 +1,6 @@
 #include "file.hpp" 
 
+#include "icemet/core/pool.hpp"
 #include "icemet/util/strfmt.hpp"
 
 #include <stdexcept>
@@ -8,9 +9,11 @@ File::File() :
 	m_sensor(0),
 	m_dt(),
 	m_frame(0),
-	m_status(FILE_STATUS_NONE) {}
+	m_status(FILE_STATUS_NONE),
+	param() {}
 
-File::File(const fs::path& p)
+File::File(const fs::path& p) :
+	param()
 {
 	setName(p.stem().string());
 	setPath(p);
@@ -20,7 +23,8 @@ File::File(unsigned int sensor, DateTime dt, unsigned int frame, FileStatus stat
 	m_sensor(sensor),
 	m_dt(dt),
 	m_frame(frame),
-	m_status(status) {}
+	m_status(status),
+	param() {}
 
 std::string File::name() const
 {
@@ -83,6 +87,35 @@ fs::path File::dir(const fs::path& root) const
 	return root / p;
 }
 
+size_t File::memory() const
+{
+	size_t n = original.total()*original.elemSize() + preproc.total()*preproc.elemSize();
+	for (const auto& segm : segments)
+		n += segm->img.total() * segm->img.elemSize();
+	for (const auto& par : particles)
+		n += par->mask.memory();
+	return n;
+}
+
+void File::releaseImages()
+{
+	ImagePool::release(original);
+	ImagePool::release(preproc);
+	for (const auto& segm : segments)
+		segm->img.release();
+	for (const auto& par : particles)
+		par->mask.release();
+}
+
+FileSummary File::summary() const
+{
+	FileSummary summary = {param.seq, name(), m_dt, m_status, param.preprocessed, param.shed, {}};
+	summary.particles.reserve(particles.size());
+	for (const auto& par : particles)
+		summary.particles.push_back({par->z, par->diam, par->circularity, par->dynRange});
+	return summary;
+}
+
 bool operator==(const File& f1, const File& f2)
 {
 	return (
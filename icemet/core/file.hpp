@@ -2,6 +2,8 @@
 #define ICEMET_FILE_H
 
 #include "icemet/worker.hpp"
+#include "icemet/core/mask.hpp"
+#include "icemet/core/math.hpp"
 #include "icemet/util/time.hpp"
 
 #include <opencv2/core.hpp>
@@ -9,6 +11,7 @@
 
 #include <filesystem>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -33,11 +36,10 @@ typedef struct _segment {
 	{
 		img_.copyTo(img);
 	}
-	_segment(const _segment& s) :
-		z(s.z), iter(s.iter), score(s.score), method(s.method), rect(s.rect)
-	{
-		s.img.copyTo(img);
-	}
+	_segment(const _segment& s) = delete;
+	_segment(_segment&& s) = default;
+	_segment& operator=(const _segment&) = delete;
+	_segment& operator=(_segment&&) = default;
 } Segment;
 typedef cv::Ptr<Segment> SegmentPtr;
 
@@ -48,32 +50,54 @@ typedef struct _particle {
 	float circularity;
 	unsigned char dynRange;
 	float effPxSz;
-	cv::Mat img;
+	Mask mask;
 	
 	_particle() {}
-	_particle(float x_, float y_, float z_, float diam_, float diamCorr_, float circularity_, unsigned char dynRange_, float effPxSz_, const cv::UMat& img_) :
+	_particle(float x_, float y_, float z_, float diam_, float diamCorr_, float circularity_, unsigned char dynRange_, float effPxSz_, Mask&& mask_) :
 		x(x_), y(y_), z(z_),
 		diam(diam_), diamCorr(diamCorr_),
 		circularity(circularity_),
-		dynRange(dynRange_), effPxSz(effPxSz_)
-	{
-		img_.copyTo(img);
-	}
-	_particle(const _particle& p) :
-		x(p.x), y(p.y), z(p.z),
-		diam(p.diam), diamCorr(p.diamCorr),
-		circularity(p.circularity),
-		dynRange(p.dynRange), effPxSz(p.effPxSz)
-	{
-		p.img.copyTo(img);
-	}
+		dynRange(dynRange_), effPxSz(effPxSz_),
+		mask(std::move(mask_)) {}
+	_particle(const _particle& p) = delete;
+	_particle(_particle&& p) = default;
+	_particle& operator=(const _particle&) = delete;
+	_particle& operator=(_particle&&) = default;
 } Particle;
 typedef cv::Ptr<Particle> ParticlePtr;
 
 typedef struct _file_param {
 	unsigned char bgVal; // Background value of the preprocessed file
+	ImageStats stats; // Statistics of the preprocessed image
+	unsigned int allocs; // Pool allocations made while processing the file
+	bool preprocessed; // Preprocessed image was created
+	unsigned int seq; // Input order, kept through replicated stages
+	chr::steady_clock::time_point found; // When the Watcher found the file
+	bool shed; // Left unprocessed by the real-time mode
+	bool context; // Read only to warm up the background subtraction of a shard
+	bool shared; // The original is also read by a neighbouring shard
+	bool released; // The Saver is done with the shared original
 } FileParam;
 
+// Particle properties needed for statistics
+typedef struct _particle_summary {
+	float z;
+	float diam;
+	float circularity;
+	unsigned char dynRange;
+} ParticleSummary;
+
+// Image-free copy of a file for statistics
+typedef struct _file_summary {
+	unsigned int seq;
+	std::string name;
+	DateTime dt;
+	FileStatus status;
+	bool preprocessed;
+	bool shed;
+	std::vector<ParticleSummary> particles;
+} FileSummary;
+
 class File {
 private:
 	unsigned int m_sensor;
@@ -114,6 +138,10 @@ public:
 	
 	fs::path dir(const fs::path& root) const;
 	
+	size_t memory() const;
+	void releaseImages();
+	FileSummary summary() const;
+	
 	friend bool operator==(const File& f1, const File& f2);
 	friend bool operator!=(const File& f1, const File& f2);
 	friend bool operator<(const File& f1, const File& f2);
@@ -123,5 +151,6 @@ public:
 };
 typedef cv::Ptr<File> FilePtr;
 typedef WorkerQueue<FilePtr> FileQueue;
+typedef WorkerQueue<FileSummary> SummaryQueue;
 
 #endif
@@ -0,0 +1,89 @@
+#include "focus.hpp"
+
+#include <opencv2/imgproc.hpp>
+
+static const char* kernelSource = R"(
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+#define SUM(y, x) (*(__global const uint*)(sum + sumOffset + (y)*sumStep + (x)*4))
+#define SQSUM(y, x) (*(__global const double*)(sqsum + sqOffset + (y)*sqStep + (x)*8))
+
+__kernel void rect_std(
+	__global const uchar* sum, int sumStep, int sumOffset,
+	__global const uchar* sqsum, int sqStep, int sqOffset,
+	__global const int* rects, int n,
+	__global float* scores, int row)
+{
+	int i = get_global_id(0);
+	if (i >= n)
+		return;
+	int x0 = rects[4*i], y0 = rects[4*i+1];
+	int x1 = x0 + rects[4*i+2], y1 = y0 + rects[4*i+3];
+	double area = (double)rects[4*i+2] * rects[4*i+3];
+	// The 32-bit integral wraps on frames above 2^31/255 pixels. The wrap
+	// cancels in unsigned differences, since a rect sums to less than 2^32.
+	uint s = SUM(y1, x1) - SUM(y0, x1) - SUM(y1, x0) + SUM(y0, x0);
+	double sq = SQSUM(y1, x1) - SQSUM(y0, x1) - SQSUM(y1, x0) + SQSUM(y0, x0);
+	double mean = (double)s / area;
+	scores[row*n + i] = sqrt(fmax(sq/area - mean*mean, 0.0));
+}
+)";
+
+IntegralFocus::IntegralFocus()
+{
+	if (!cv::ocl::useOpenCL() || !cv::ocl::Device::getDefault().doubleFPConfig())
+		return;
+	cv::ocl::ProgramSource source(kernelSource);
+	cv::String err;
+	m_kernel.create("rect_std", source, "", &err);
+}
+
+bool IntegralFocus::focus(const std::vector<cv::UMat>& stack, int begin, int end, const std::vector<cv::Rect>& rects, std::vector<int>& idx, std::vector<double>& score)
+{
+	int n = rects.size();
+	int planes = end - begin + 1;
+	if (!available() || stack[begin].type() != CV_8UC1)
+		return false;
+	idx.assign(n, begin);
+	score.assign(n, 0.0);
+	if (!n)
+		return true;
+	
+	cv::Mat rectsMat(n, 4, CV_32SC1);
+	for (int i = 0; i < n; i++) {
+		const cv::Rect& r = rects[i];
+		rectsMat.at<int>(i, 0) = r.x;
+		rectsMat.at<int>(i, 1) = r.y;
+		rectsMat.at<int>(i, 2) = r.width;
+		rectsMat.at<int>(i, 3) = r.height;
+	}
+	cv::UMat rectsBuf = rectsMat.getUMat(cv::ACCESS_READ);
+	m_scores.create(planes, n, CV_32FC1);
+	
+	// Score every rect on every plane
+	size_t global = n;
+	for (int k = 0; k < planes; k++) {
+		cv::integral(stack[begin+k], m_sum, m_sqsum, CV_32S, CV_64F);
+		m_kernel.args(
+			cv::ocl::KernelArg::ReadOnlyNoSize(m_sum),
+			cv::ocl::KernelArg::ReadOnlyNoSize(m_sqsum),
+			cv::ocl::KernelArg::PtrReadOnly(rectsBuf), n,
+			cv::ocl::KernelArg::PtrWriteOnly(m_scores), k
+		);
+		if (!m_kernel.run(1, &global, NULL, false))
+			return false;
+	}
+	
+	// Select the best plane for each rect
+	cv::Mat scores = m_scores.getMat(cv::ACCESS_READ);
+	for (int k = 0; k < planes; k++) {
+		const float* row = scores.ptr<float>(k);
+		for (int i = 0; i < n; i++) {
+			if (row[i] > score[i]) {
+				score[i] = row[i];
+				idx[i] = begin + k;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,26 @@
+#ifndef ICEMET_FOCUS_H
+#define ICEMET_FOCUS_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/ocl.hpp>
+
+#include <vector>
+
+// Standard deviation focus for many rects at once. Each plane is summed into
+// integral images of I and I^2 once, after which every rect costs four
+// lookups per plane.
+class IntegralFocus {
+private:
+	cv::ocl::Kernel m_kernel;
+	cv::UMat m_sum;
+	cv::UMat m_sqsum;
+	cv::UMat m_scores;
+
+public:
+	IntegralFocus();
+	
+	bool available() const { return !m_kernel.empty(); }
+	bool focus(const std::vector<cv::UMat>& stack, int begin, int end, const std::vector<cv::Rect>& rects, std::vector<int>& idx, std::vector<double>& score);
+};
+
+#endif
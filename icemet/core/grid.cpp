@@ -0,0 +1,61 @@
+#include "grid.hpp"
+
+#include <algorithm>
+
+RectGrid::RectGrid(const cv::Size2i& size, int cell) :
+	m_size(size),
+	m_cell(cell),
+	m_cells((size.width + cell - 1) / cell, (size.height + cell - 1) / cell),
+	m_grid(m_cells.area()) {}
+
+cv::Rect RectGrid::cells(const cv::Rect& rect) const
+{
+	// Cells covered by the rect, clamped to the grid
+	int x0 = std::clamp(rect.x / m_cell, 0, m_cells.width-1);
+	int y0 = std::clamp(rect.y / m_cell, 0, m_cells.height-1);
+	int x1 = std::clamp((rect.x + rect.width - 1) / m_cell, 0, m_cells.width-1);
+	int y1 = std::clamp((rect.y + rect.height - 1) / m_cell, 0, m_cells.height-1);
+	return cv::Rect(x0, y0, x1-x0+1, y1-y0+1);
+}
+
+void RectGrid::clear()
+{
+	for (auto& cell : m_grid)
+		cell.clear();
+}
+
+void RectGrid::insert(int idx, const cv::Rect& rect)
+{
+	cv::Rect c = cells(rect);
+	for (int y = c.y; y < c.y + c.height; y++) {
+		for (int x = c.x; x < c.x + c.width; x++)
+			m_grid[y*m_cells.width + x].push_back(idx);
+	}
+}
+
+void RectGrid::remove(int idx, const cv::Rect& rect)
+{
+	cv::Rect c = cells(rect);
+	for (int y = c.y; y < c.y + c.height; y++) {
+		for (int x = c.x; x < c.x + c.width; x++) {
+			auto& cell = m_grid[y*m_cells.width + x];
+			cell.erase(std::remove(cell.begin(), cell.end(), idx), cell.end());
+		}
+	}
+}
+
+void RectGrid::query(const cv::Rect& rect, std::vector<int>& idx) const
+{
+	idx.clear();
+	cv::Rect c = cells(rect);
+	for (int y = c.y; y < c.y + c.height; y++) {
+		for (int x = c.x; x < c.x + c.width; x++) {
+			const auto& cell = m_grid[y*m_cells.width + x];
+			idx.insert(idx.end(), cell.begin(), cell.end());
+		}
+	}
+	
+	// Sorted without duplicates, so the first match is the oldest rect
+	std::sort(idx.begin(), idx.end());
+	idx.erase(std::unique(idx.begin(), idx.end()), idx.end());
+}
@@ -0,0 +1,27 @@
+#ifndef ICEMET_GRID_H
+#define ICEMET_GRID_H
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+// Uniform grid of image cells for finding rects that may overlap a given rect
+class RectGrid {
+private:
+	cv::Size2i m_size;
+	int m_cell;
+	cv::Size2i m_cells;
+	std::vector<std::vector<int>> m_grid;
+	
+	cv::Rect cells(const cv::Rect& rect) const;
+
+public:
+	RectGrid(const cv::Size2i& size, int cell=64);
+	
+	void clear();
+	void insert(int idx, const cv::Rect& rect);
+	void remove(int idx, const cv::Rect& rect);
+	void query(const cv::Rect& rect, std::vector<int>& idx) const;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "label.hpp"
+
+#include <cmath>
+#include <utility>
+
+// Chain code directions, counterclockwise starting from east
+static const cv::Point dirs[8] = {
+	{1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}, {-1, 1}, {0, 1}, {1, 1}
+};
+
+int Labeler::find(int i)
+{
+	while (m_labels[i] != i) {
+		m_labels[i] = m_labels[m_labels[i]];
+		i = m_labels[i];
+	}
+	return i;
+}
+
+void Labeler::unite(int i, int j)
+{
+	i = find(i);
+	j = find(j);
+	if (i == j)
+		return;
+	if (j < i)
+		std::swap(i, j);
+	m_labels[j] = i;
+	m_outside[i] = m_outside[i] || m_outside[j];
+}
+
+int Labeler::runAt(int x, int y) const
+{
+	int lo = m_rows[y], hi = m_rows[y+1] - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (m_runs[mid].x0 <= x)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+bool Labeler::fg(const cv::Point& p) const
+{
+	return p.x >= 0 && p.y >= 0 && p.x < m_img->cols && p.y < m_img->rows &&
+	       m_img->at<unsigned char>(p) <= m_th;
+}
+
+void Labeler::label(const cv::Mat& img, int th)
+{
+	m_img = &img;
+	m_th = th;
+	m_runs.clear();
+	m_rows.clear();
+	m_labels.clear();
+	m_outside.clear();
+	m_comps.clear();
+	m_external.clear();
+	
+	// Runs of foreground and background, alternating along each row
+	for (int y = 0; y < img.rows; y++) {
+		m_rows.push_back(m_runs.size());
+		const unsigned char* row = img.ptr<unsigned char>(y);
+		int x0 = 0;
+		while (x0 < img.cols) {
+			bool isFg = row[x0] <= th;
+			int x1 = x0 + 1;
+			while (x1 < img.cols && (row[x1] <= th) == isFg)
+				x1++;
+			int i = m_runs.size();
+			m_runs.push_back({y, x0, x1, isFg});
+			m_labels.push_back(i);
+			m_outside.push_back(!isFg && (y == 0 || y == img.rows-1 || x0 == 0 || x1 == img.cols));
+			x0 = x1;
+		}
+	}
+	m_rows.push_back(m_runs.size());
+	
+	// Connect runs to the overlapping runs of the previous row
+	for (int y = 1; y < img.rows; y++) {
+		int start = m_rows[y-1];
+		for (int i = m_rows[y]; i < m_rows[y+1]; i++) {
+			const LabelRun& run = m_runs[i];
+			while (m_runs[start].x1 < run.x0)
+				start++;
+			for (int j = start; j < m_rows[y] && m_runs[j].x0 <= run.x1; j++) {
+				const LabelRun& prev = m_runs[j];
+				if (prev.fg != run.fg)
+					continue;
+				if (run.fg || (prev.x0 < run.x1 && run.x0 < prev.x1))
+					unite(i, j);
+			}
+		}
+	}
+	
+	for (int i = 0; i < (int)m_runs.size(); i++)
+		m_labels[i] = find(i);
+	
+	// Components numbered in raster order of their first run
+	for (int i = 0; i < (int)m_runs.size(); i++) {
+		const LabelRun& run = m_runs[i];
+		int root = m_labels[i];
+		int c;
+		if (root == i) {
+			c = m_comps.size();
+			LabelComp comp;
+			comp.fg = run.fg;
+			comp.outside = m_outside[i];
+			comp.first = i;
+			comp.parent = -1;
+			comp.ext = -1;
+			comp.area = 0;
+			comp.filled = 0;
+			comp.rect = cv::Rect(run.x0, run.y, run.x1-run.x0, 1);
+			m_comps.push_back(comp);
+		}
+		else {
+			c = m_labels[root];
+		}
+		m_labels[i] = c;
+		
+		LabelComp& comp = m_comps[c];
+		comp.area += run.x1 - run.x0;
+		comp.rect |= cv::Rect(run.x0, run.y, run.x1-run.x0, 1);
+	}
+	
+	// A foreground component is surrounded by the background left of its
+	// first pixel and a hole is enclosed by the foreground above its first
+	// pixel. Both lie earlier in raster order.
+	for (int c = 0; c < (int)m_comps.size(); c++) {
+		LabelComp& comp = m_comps[c];
+		const LabelRun& run = m_runs[comp.first];
+		if (comp.fg) {
+			if (run.x0 > 0 && !m_comps[m_labels[comp.first-1]].outside)
+				comp.parent = m_labels[comp.first-1];
+			comp.ext = comp.parent < 0 ? c : m_comps[comp.parent].ext;
+			if (comp.parent < 0)
+				m_external.push_back(c);
+		}
+		else if (!comp.outside) {
+			comp.parent = m_labels[runAt(run.x0, run.y-1)];
+			comp.ext = m_comps[comp.parent].ext;
+		}
+		if (comp.ext >= 0)
+			m_comps[comp.ext].filled += comp.area;
+	}
+}
+
+int Labeler::component(const cv::Point& p) const
+{
+	return m_comps[m_labels[runAt(p.x, p.y)]].ext;
+}
+
+double Labeler::perimeter(int i)
+{
+	const LabelRun& run = m_runs[m_comps[i].first];
+	const cv::Point p0(run.x0, run.y);
+	
+	// First neighbour clockwise from the west
+	int s = 4;
+	cv::Point p1;
+	do {
+		s = (s - 1) & 7;
+		p1 = p0 + dirs[s];
+	} while (!fg(p1) && s != 4);
+	if (!fg(p1))
+		return 0.0;
+	
+	// Follow the border counterclockwise, keeping the points where the
+	// direction changes
+	m_points.clear();
+	int prev = s ^ 4;
+	cv::Point p3 = p0, p4;
+	for (;;) {
+		int n;
+		for (n = 1; n <= 8; n++) {
+			p4 = p3 + dirs[(s+n) & 7];
+			if (fg(p4))
+				break;
+		}
+		s = (s + n) & 7;
+		if (s != prev) {
+			m_points.push_back(p3);
+			prev = s;
+		}
+		if (p4 == p0 && p3 == p1)
+			break;
+		p3 = p4;
+		s = (s + 4) & 7;
+	}
+	
+	// Closed polygon length computed as in arcLength
+	double perim = 0.0;
+	cv::Point2f pPrev(m_points.back());
+	for (const auto& p : m_points) {
+		float dx = p.x - pPrev.x, dy = p.y - pPrev.y;
+		perim += std::sqrt(dx*dx + dy*dy);
+		pPrev = cv::Point2f(p);
+	}
+	return m_points.size() > 1 ? perim : 0.0;
+}
+
+Mask Labeler::mask(int i) const
+{
+	std::vector<MaskRun> runs;
+	for (int r = m_comps[i].first; r < (int)m_runs.size(); r++) {
+		if (m_comps[m_labels[r]].ext != i)
+			continue;
+		const LabelRun& run = m_runs[r];
+		if (!runs.empty() && runs.back().y == run.y && runs.back().x + runs.back().len == run.x0)
+			runs.back().len += run.x1 - run.x0;
+		else
+			runs.push_back({(uint16_t)run.y, (uint16_t)run.x0, (uint16_t)(run.x1 - run.x0)});
+	}
+	return Mask(m_img->size(), std::move(runs));
+}
@@ -0,0 +1,60 @@
+#ifndef ICEMET_LABEL_H
+#define ICEMET_LABEL_H
+
+#include "icemet/core/mask.hpp"
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+typedef struct _label_run {
+	int y;
+	int x0, x1; // Columns [x0, x1)
+	bool fg;
+} LabelRun;
+
+typedef struct _label_comp {
+	bool fg;
+	bool outside; // Background connected to the image border
+	int first; // Topmost-leftmost run
+	int parent; // Surrounding background or enclosing foreground component
+	int ext; // External foreground component containing this one
+	int area;
+	int filled; // Area including holes and nested components
+	cv::Rect rect;
+} LabelComp;
+
+// Connected component labeling of a thresholded image in one pass over run
+// lengths. Foreground (pixels <= th) is 8-connected and background
+// 4-connected, which gives the same external components, bounding boxes,
+// filled areas and perimeters as findContours with RETR_EXTERNAL.
+class Labeler {
+private:
+	const cv::Mat* m_img;
+	int m_th;
+	std::vector<LabelRun> m_runs;
+	std::vector<int> m_rows; // First run of each row
+	std::vector<int> m_labels; // Union-find parents, component indices after resolving
+	std::vector<bool> m_outside;
+	std::vector<LabelComp> m_comps;
+	std::vector<int> m_external;
+	std::vector<cv::Point> m_points;
+	
+	int find(int i);
+	void unite(int i, int j);
+	int runAt(int x, int y) const;
+	bool fg(const cv::Point& p) const;
+
+public:
+	Labeler() : m_img(NULL), m_th(0) {}
+	
+	void label(const cv::Mat& img, int th);
+	
+	const std::vector<int>& external() const { return m_external; }
+	const LabelComp& comp(int i) const { return m_comps[i]; }
+	int component(const cv::Point& p) const;
+	double perimeter(int i);
+	Mask mask(int i) const;
+};
+
+#endif
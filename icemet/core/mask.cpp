@@ -0,0 +1,50 @@
+#include "mask.hpp"
+
+#include <algorithm>
+
+Mask::Mask(const cv::Mat& img) :
+	m_size(img.size())
+{
+	CV_Assert(img.type() == CV_8UC1);
+	for (int y = 0; y < img.rows; y++) {
+		const unsigned char* row = img.ptr<unsigned char>(y);
+		int x = 0;
+		while (x < img.cols) {
+			// Skip background
+			while (x < img.cols && !row[x])
+				x++;
+			if (x >= img.cols)
+				break;
+			
+			// Measure the run
+			int start = x;
+			while (x < img.cols && row[x])
+				x++;
+			m_runs.push_back({(uint16_t)y, (uint16_t)start, (uint16_t)(x-start)});
+		}
+	}
+}
+
+int Mask::area() const
+{
+	int n = 0;
+	for (const auto& run : m_runs)
+		n += run.len;
+	return n;
+}
+
+void Mask::expand(cv::Mat& dst) const
+{
+	dst.create(m_size, CV_8UC1);
+	dst.setTo(0);
+	for (const auto& run : m_runs) {
+		unsigned char* row = dst.ptr<unsigned char>(run.y);
+		std::fill(row + run.x, row + run.x + run.len, 255);
+	}
+}
+
+void Mask::release()
+{
+	m_size = cv::Size2i(0, 0);
+	std::vector<MaskRun>().swap(m_runs);
+}
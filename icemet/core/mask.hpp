@@ -0,0 +1,37 @@
+#ifndef ICEMET_MASK_H
+#define ICEMET_MASK_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+typedef struct _mask_run {
+	uint16_t y;
+	uint16_t x;
+	uint16_t len;
+} MaskRun;
+
+// Run-length encoded binary image
+class Mask {
+private:
+	cv::Size2i m_size;
+	std::vector<MaskRun> m_runs;
+
+public:
+	Mask() : m_size(0, 0) {}
+	Mask(const cv::Mat& img);
+	Mask(const cv::Size2i& size, std::vector<MaskRun>&& runs) : m_size(size), m_runs(std::move(runs)) {}
+	
+	cv::Size2i size() const { return m_size; }
+	const std::vector<MaskRun>& runs() const { return m_runs; }
+	bool empty() const { return m_runs.empty(); }
+	int area() const;
+	size_t memory() const { return m_runs.capacity() * sizeof(MaskRun); }
+	
+	void expand(cv::Mat& dst) const;
+	void release();
+};
+
+#endif
@@ -1,8 +1,14 @@
 #include "math.hpp" 
 
-#include <opencv2/icemet.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/core/utility.hpp>
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <vector>
+
+#define STRIPE_ROWS 64
 
 const double Math::pi = 3.14159265358979323846;
 
@@ -16,15 +22,90 @@ double Math::heywood(double perim, double area)
 	return perim / (2*sqrt(pi*area));
 }
 
-int Math::median(cv::UMat img)
+ImageStats Math::stats(const cv::UMat& img)
 {
-	cv::Mat hist;
-	cv::icemet::imghist(img, hist);
+	cv::Mat mat = img.getMat(cv::ACCESS_READ);
+	const int rows = mat.rows;
+	const int cols = mat.cols;
+	
+	// Histogram, min and max of row stripes in parallel, reading every
+	// pixel once. Min and max are kept in vector registers. The counters
+	// can't be vectorized without a scatter, so each loaded vector is
+	// counted bytewise into four interleaved tables that keep runs of equal
+	// pixels from stalling on the same counter.
+	const int nstripes = (rows + STRIPE_ROWS - 1) / STRIPE_ROWS;
+	std::vector<int> hists(nstripes*256);
+	std::vector<unsigned char> mins(nstripes, 255);
+	std::vector<unsigned char> maxs(nstripes, 0);
+	cv::parallel_for_(cv::Range(0, nstripes), [&](const cv::Range& range) {
+		int h[4][256];
+		for (int s = range.start; s < range.end; s++) {
+			std::memset(h, 0, sizeof(h));
+			unsigned char lo = 255, hi = 0;
+#if CV_SIMD
+			const int step = cv::v_uint8::nlanes;
+			cv::v_uint8 vlo = cv::vx_setall_u8(255);
+			cv::v_uint8 vhi = cv::vx_setzero_u8();
+#endif
+			for (int y = s*STRIPE_ROWS; y < std::min(rows, (s+1)*STRIPE_ROWS); y++) {
+				const unsigned char* p = mat.ptr<unsigned char>(y);
+				int x = 0;
+#if CV_SIMD
+				for (; x <= cols-step; x += step) {
+					cv::v_uint8 v = cv::vx_load(p + x);
+					vlo = cv::v_min(vlo, v);
+					vhi = cv::v_max(vhi, v);
+					for (int i = x; i < x + step; i += 4) {
+						h[0][p[i]]++;
+						h[1][p[i+1]]++;
+						h[2][p[i+2]]++;
+						h[3][p[i+3]]++;
+					}
+				}
+#endif
+				for (; x < cols; x++) {
+					lo = std::min(lo, p[x]);
+					hi = std::max(hi, p[x]);
+					h[0][p[x]]++;
+				}
+			}
+#if CV_SIMD
+			lo = std::min(lo, (unsigned char)cv::v_reduce_min(vlo));
+			hi = std::max(hi, (unsigned char)cv::v_reduce_max(vhi));
+#endif
+			mins[s] = lo;
+			maxs[s] = hi;
+			int* dst = &hists[s*256];
+			for (int i = 0; i < 256; i++)
+				dst[i] = h[0][i] + h[1][i] + h[2][i] + h[3][i];
+		}
+#if CV_SIMD
+		cv::vx_cleanup();
+#endif
+	});
+	
+	// Median from the histogram
+	ImageStats stats;
+	stats.min = 255;
+	stats.max = 0;
+	int hist[256] = {0};
+	for (int s = 0; s < nstripes; s++) {
+		stats.min = std::min<int>(stats.min, mins[s]);
+		stats.max = std::max<int>(stats.max, maxs[s]);
+		for (int i = 0; i < 256; i++)
+			hist[i] += hists[s*256 + i];
+	}
 	int sum = 0;
 	int i = 0;
-	while (sum < img.cols * img.rows / 2)
-		sum += hist.at<int>(0, i++);
-	return i-1;
+	while (sum < cols * rows / 2)
+		sum += hist[i++];
+	stats.median = i-1;
+	return stats;
+}
+
+int Math::median(cv::UMat img)
+{
+	return stats(img).median;
 }
 
 double Math::Vcone(double h, double A1, double A2)
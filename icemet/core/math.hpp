@@ -3,11 +3,18 @@
 
 #include <opencv2/core.hpp>
 
+typedef struct _image_stats {
+	int min;
+	int max;
+	int median;
+} ImageStats;
+
 class Math {
 public:
 	static const double pi;
 	static double equivdiam(double area);
 	static double heywood(double perim, double area);
+	static ImageStats stats(const cv::UMat& img);
 	static int median(cv::UMat img);
 	static double Vcone(double h, double A1, double A2);
 };
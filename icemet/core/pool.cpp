@@ -0,0 +1,116 @@
+#include "pool.hpp"
+
+#include <opencv2/core/ocl.hpp>
+
+static thread_local unsigned int allocsThread = 0; // Allocations made by the calling thread
+static std::once_flag allocsOnce;
+
+// Host buffers at least this large are counted
+static const size_t allocsLarge = 65536;
+
+// Counts the large allocations of every host Mat, including the ones made
+// inside OpenCV, and leaves the allocation itself to the standard allocator
+class CountingAllocator : public cv::MatAllocator {
+private:
+	const cv::MatAllocator* m_std;
+
+public:
+	CountingAllocator(const cv::MatAllocator* std) : m_std(std) {}
+	
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+	{
+		cv::UMatData* u = m_std->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		if (!data && u && u->size >= allocsLarge)
+			allocsThread++;
+		return u;
+	}
+	
+	bool allocate(cv::UMatData* u, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+	{
+		return m_std->allocate(u, accessFlags, usageFlags);
+	}
+	
+	void deallocate(cv::UMatData* u) const override
+	{
+		m_std->deallocate(u);
+	}
+};
+
+ImagePool::ImagePool() :
+	m_allocs(0)
+{
+	// Installed before the workers start
+	std::call_once(allocsOnce, []() {
+		static CountingAllocator allocator(cv::Mat::getStdAllocator());
+		cv::Mat::setDefaultAllocator(&allocator);
+	});
+}
+
+cv::UMat ImagePool::getUMat(const cv::Size2i& size, int type)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	// Only the pool is holding a free buffer. Temporaries may still be used
+	// by OpenCL work queued earlier, which the in-order queue of the same
+	// thread finishes first.
+	const std::thread::id id = std::this_thread::get_id();
+	for (size_t i = 0; i < m_umats.size(); i++) {
+		const cv::UMat& buf = m_umats[i];
+		if (buf.size() == size && buf.type() == type && m_owners[i] == id &&
+		    buf.u->urefcount == 1 && buf.u->refcount == 0)
+			return buf;
+	}
+	
+	m_umats.push_back(cv::UMat(size, type));
+	m_owners.push_back(id);
+	m_allocs++;
+	
+	// Host memory is counted by the allocator
+	if (cv::UMat::getStdAllocator() != cv::Mat::getDefaultAllocator())
+		allocsThread++;
+	return m_umats.back();
+}
+
+cv::Mat ImagePool::getMat(const cv::Size2i& size, int type)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	for (const auto& buf : m_mats) {
+		if (buf.size() == size && buf.type() == type &&
+		    buf.u->refcount == 1 && buf.u->urefcount == 0)
+			return buf;
+	}
+	
+	m_mats.push_back(cv::Mat(size, type));
+	m_allocs++;
+	return m_mats.back();
+}
+
+size_t ImagePool::count()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_umats.size() + m_mats.size();
+}
+
+size_t ImagePool::bytes()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t n = 0;
+	for (const auto& buf : m_umats)
+		n += buf.total() * buf.elemSize();
+	for (const auto& buf : m_mats)
+		n += buf.total() * buf.elemSize();
+	return n;
+}
+
+unsigned int ImagePool::threadAllocs()
+{
+	return allocsThread;
+}
+
+void ImagePool::release(cv::UMat& img)
+{
+	if (!img.empty() && cv::ocl::useOpenCL())
+		cv::ocl::finish();
+	img.release();
+}
@@ -0,0 +1,41 @@
+#ifndef ICEMET_POOL_H
+#define ICEMET_POOL_H
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Recycles image buffers between frames. A buffer is handed out again once
+// every other reference to it has been released.
+class ImagePool {
+private:
+	std::vector<cv::UMat> m_umats;
+	std::vector<std::thread::id> m_owners; // Thread that allocated each UMat
+	std::vector<cv::Mat> m_mats;
+	std::mutex m_mutex;
+	std::atomic<unsigned int> m_allocs;
+
+public:
+	ImagePool();
+	ImagePool(const ImagePool& pool) = delete;
+	ImagePool& operator=(const ImagePool&) = delete;
+	
+	cv::UMat getUMat(const cv::Size2i& size, int type);
+	cv::Mat getMat(const cv::Size2i& size, int type);
+	
+	size_t count();
+	size_t bytes();
+	unsigned int allocs() const { return m_allocs.load(); }
+	
+	// Large host allocations and new device buffers of the calling thread
+	static unsigned int threadAllocs();
+	
+	// Drops an image another thread may take from the pool next. OpenCL
+	// work queued on it by the calling thread is finished first.
+	static void release(cv::UMat& img);
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "metrics.hpp"
+
+#include "icemet/util/strfmt.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+#define HIST_BUCKETS 16
+#define HIST_FIRST 0.001
+
+static std::mutex registryMutex;
+static std::vector<WorkerMetrics*> registryWorkers;
+static std::vector<QueueMetrics*> registryQueues;
+
+static std::string labelName(const std::string& str)
+{
+	std::string name = strnocolor(str);
+	for (auto& c : name)
+		c = std::tolower(c);
+	return name;
+}
+
+Histogram::Histogram() :
+	m_counts(HIST_BUCKETS+1, 0),
+	m_count(0),
+	m_sum(0.0)
+{
+	for (int i = 0; i < HIST_BUCKETS; i++)
+		m_bounds.push_back(HIST_FIRST * (1 << i));
+}
+
+void Histogram::observe(double val)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t i = std::lower_bound(m_bounds.begin(), m_bounds.end(), val) - m_bounds.begin();
+	m_counts[i]++;
+	m_count++;
+	m_sum += val;
+}
+
+unsigned long long Histogram::count() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_count;
+}
+
+double Histogram::sum() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_sum;
+}
+
+double Histogram::quantile(double q) const
+{
+	// Interpolate linearly inside the bucket holding the rank. Values past
+	// the last bound are reported as the last bound.
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_count)
+		return 0.0;
+	double rank = q * m_count;
+	unsigned long long cum = 0;
+	for (size_t i = 0; i < m_bounds.size(); i++) {
+		if (cum + m_counts[i] >= rank && m_counts[i]) {
+			double lower = i ? m_bounds[i-1] : 0.0;
+			return lower + (m_bounds[i] - lower) * (rank - cum) / m_counts[i];
+		}
+		cum += m_counts[i];
+	}
+	return m_bounds.back();
+}
+
+void Histogram::write(std::string& out, const std::string& name, const std::string& labels) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	unsigned long long cum = 0;
+	for (size_t i = 0; i < m_bounds.size(); i++) {
+		cum += m_counts[i];
+		out += strfmt("%s_bucket{%s,le=\"%g\"} %llu\n", name.c_str(), labels.c_str(), m_bounds[i], cum);
+	}
+	out += strfmt("%s_bucket{%s,le=\"+Inf\"} %llu\n", name.c_str(), labels.c_str(), m_count);
+	out += strfmt("%s_sum{%s} %.6f\n", name.c_str(), labels.c_str(), m_sum);
+	out += strfmt("%s_count{%s} %llu\n", name.c_str(), labels.c_str(), m_count);
+}
+
+WorkerMetrics::WorkerMetrics(const std::string& name) :
+	m_name(labelName(name)),
+	m_frames(0),
+	m_rateFrames(0)
+{
+	Metrics::add(this);
+}
+
+WorkerMetrics::~WorkerMetrics()
+{
+	Metrics::remove(this);
+}
+
+void WorkerMetrics::setName(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	m_name = labelName(name);
+}
+
+void WorkerMetrics::observe(double sec)
+{
+	m_service.observe(sec);
+	m_frames++;
+}
+
+double WorkerMetrics::rate()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	unsigned long long frames = m_frames.load();
+	double t = m_rateTime.elapsed();
+	double fps = t > 0.0 ? (frames - m_rateFrames) / t : 0.0;
+	m_rateTime.reset();
+	m_rateFrames = frames;
+	return fps;
+}
+
+void WorkerMetrics::write(std::string& out, int part)
+{
+	const std::string labels = strfmt("worker=\"%s\"", m_name.c_str());
+	double busy = m_service.sum();
+	switch (part) {
+	case 0:
+		m_service.write(out, "icemet_worker_service_seconds", labels);
+		break;
+	case 1:
+		out += strfmt("icemet_worker_frames_total{%s} %llu\n", labels.c_str(), m_frames.load());
+		break;
+	case 2:
+		out += strfmt("icemet_worker_busy_seconds_total{%s} %.6f\n", labels.c_str(), busy);
+		break;
+	case 3:
+		out += strfmt("icemet_worker_idle_seconds_total{%s} %.6f\n", labels.c_str(), std::max(0.0, m_uptime.elapsed() - busy));
+		break;
+	case 4:
+		out += strfmt("icemet_worker_frames_per_second{%s} %.3f\n", labels.c_str(), rate());
+		break;
+	}
+}
+
+QueueMetrics::QueueMetrics(const std::string& name, size_t capacity) :
+	m_name(name),
+	m_depth(0),
+	m_capacity(capacity),
+	m_blockedUs(0)
+{
+	if (!m_name.empty())
+		Metrics::add(this);
+}
+
+QueueMetrics::~QueueMetrics()
+{
+	if (!m_name.empty())
+		Metrics::remove(this);
+}
+
+void QueueMetrics::write(std::string& out, int part)
+{
+	const std::string labels = strfmt("queue=\"%s\"", m_name.c_str());
+	switch (part) {
+	case 0:
+		out += strfmt("icemet_queue_depth{%s} %zu\n", labels.c_str(), m_depth.load());
+		break;
+	case 1:
+		out += strfmt("icemet_queue_capacity{%s} %zu\n", labels.c_str(), m_capacity);
+		break;
+	case 2:
+		m_wait.write(out, "icemet_queue_wait_seconds", labels);
+		break;
+	case 3:
+		out += strfmt("icemet_queue_blocked_seconds_total{%s} %.6f\n", labels.c_str(), m_blockedUs.load() / 1000000.0);
+		break;
+	}
+}
+
+void Metrics::add(WorkerMetrics* metrics)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	registryWorkers.push_back(metrics);
+}
+
+void Metrics::remove(WorkerMetrics* metrics)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	registryWorkers.erase(std::remove(registryWorkers.begin(), registryWorkers.end(), metrics), registryWorkers.end());
+}
+
+void Metrics::add(QueueMetrics* metrics)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	registryQueues.push_back(metrics);
+}
+
+void Metrics::remove(QueueMetrics* metrics)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	registryQueues.erase(std::remove(registryQueues.begin(), registryQueues.end(), metrics), registryQueues.end());
+}
+
+std::vector<WorkerMetrics*> Metrics::workers()
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	return registryWorkers;
+}
+
+std::vector<QueueMetrics*> Metrics::queues()
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	return registryQueues;
+}
+
+std::string Metrics::text()
+{
+	static const char* workerFamilies[][2] = {
+		{"icemet_worker_service_seconds", "histogram"},
+		{"icemet_worker_frames_total", "counter"},
+		{"icemet_worker_busy_seconds_total", "counter"},
+		{"icemet_worker_idle_seconds_total", "counter"},
+		{"icemet_worker_frames_per_second", "gauge"}
+	};
+	static const char* queueFamilies[][2] = {
+		{"icemet_queue_depth", "gauge"},
+		{"icemet_queue_capacity", "gauge"},
+		{"icemet_queue_wait_seconds", "histogram"},
+		{"icemet_queue_blocked_seconds_total", "counter"}
+	};
+	
+	// Samples of each family are grouped together
+	std::lock_guard<std::mutex> lock(registryMutex);
+	std::string out;
+	for (int i = 0; i < 5; i++) {
+		out += strfmt("# TYPE %s %s\n", workerFamilies[i][0], workerFamilies[i][1]);
+		for (auto metrics : registryWorkers)
+			metrics->write(out, i);
+	}
+	for (int i = 0; i < 4; i++) {
+		out += strfmt("# TYPE %s %s\n", queueFamilies[i][0], queueFamilies[i][1]);
+		for (auto metrics : registryQueues)
+			metrics->write(out, i);
+	}
+	return out;
+}
@@ -0,0 +1,91 @@
+#ifndef ICEMET_METRICS_H
+#define ICEMET_METRICS_H
+
+#include "icemet/util/time.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Cumulative histogram of durations in seconds with exponential buckets
+class Histogram {
+private:
+	std::vector<double> m_bounds;
+	std::vector<unsigned long long> m_counts;
+	unsigned long long m_count;
+	double m_sum;
+	mutable std::mutex m_mutex;
+
+public:
+	Histogram();
+	Histogram(const Histogram& hist) = delete;
+	Histogram& operator=(const Histogram&) = delete;
+	
+	void observe(double val);
+	unsigned long long count() const;
+	double sum() const;
+	double quantile(double q) const;
+	void write(std::string& out, const std::string& name, const std::string& labels) const;
+};
+
+// Service times and throughput of one worker
+class WorkerMetrics {
+private:
+	std::string m_name;
+	Measure m_uptime;
+	Histogram m_service;
+	std::atomic<unsigned long long> m_frames;
+	std::mutex m_mutex;
+	Measure m_rateTime;
+	unsigned long long m_rateFrames;
+
+public:
+	WorkerMetrics(const std::string& name);
+	~WorkerMetrics();
+	
+	const std::string& name() const { return m_name; }
+	void setName(const std::string& name);
+	const Histogram& service() const { return m_service; }
+	unsigned long long frames() const { return m_frames.load(); }
+	double uptime() const { return m_uptime.elapsed(); }
+	void observe(double sec);
+	double rate();
+	void write(std::string& out, int part);
+};
+
+// Depth and wait times of one queue
+class QueueMetrics {
+private:
+	std::string m_name;
+	std::atomic<size_t> m_depth;
+	size_t m_capacity;
+	Histogram m_wait;
+	std::atomic<unsigned long long> m_blockedUs;
+
+public:
+	QueueMetrics(const std::string& name, size_t capacity);
+	~QueueMetrics();
+	
+	const std::string& name() const { return m_name; }
+	const Histogram& wait() const { return m_wait; }
+	double blocked() const { return m_blockedUs.load() / 1000000.0; }
+	void setDepth(size_t depth) { m_depth.store(depth); }
+	void observeWait(double sec) { m_wait.observe(sec); }
+	void addBlocked(double sec) { m_blockedUs += sec * 1000000; }
+	void write(std::string& out, int part);
+};
+
+// Registry of all metrics in Prometheus text format
+class Metrics {
+public:
+	static void add(WorkerMetrics* metrics);
+	static void remove(WorkerMetrics* metrics);
+	static void add(QueueMetrics* metrics);
+	static void remove(QueueMetrics* metrics);
+	static std::vector<WorkerMetrics*> workers();
+	static std::vector<QueueMetrics*> queues();
+	static std::string text();
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "numa.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+static const fs::path nodeRoot("/sys/devices/system/node");
+
+static const std::vector<std::vector<int>>& topology()
+{
+	static std::vector<std::vector<int>> nodes = []() {
+		// Node numbers may have gaps, so they are renumbered in order
+		std::map<int, std::vector<int>> found;
+		std::error_code ec;
+		for (const auto& entry : fs::directory_iterator(nodeRoot, ec)) {
+			std::string name = entry.path().filename().string();
+			if (name.compare(0, 4, "node") || name.size() == 4 || !std::all_of(name.begin()+4, name.end(), ::isdigit))
+				continue;
+			std::ifstream file(entry.path() / "cpulist");
+			std::string list;
+			if (std::getline(file, list) && !list.empty())
+				found[std::stoi(name.substr(4))] = Numa::parse(list);
+		}
+		
+		std::vector<std::vector<int>> vec;
+		for (auto& it : found)
+			vec.push_back(std::move(it.second));
+		if (vec.empty()) {
+			vec.push_back(std::vector<int>());
+			for (unsigned int i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++)
+				vec[0].push_back(i);
+		}
+		return vec;
+	}();
+	return nodes;
+}
+
+int Numa::nodes()
+{
+	return topology().size();
+}
+
+const std::vector<int>& Numa::cpus(int node)
+{
+	return topology().at(node);
+}
+
+int Numa::node(int cpu)
+{
+	const auto& nodes = topology();
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (std::find(nodes[i].begin(), nodes[i].end(), cpu) != nodes[i].end())
+			return i;
+	}
+	return -1;
+}
+
+bool Numa::bind(const std::vector<int>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus) {
+		if (cpu >= 0 && cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	}
+	return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+std::string Numa::str(const std::vector<int>& cpus)
+{
+	std::vector<int> sorted(cpus);
+	std::sort(sorted.begin(), sorted.end());
+	sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+	
+	std::string out;
+	for (size_t i = 0; i < sorted.size();) {
+		size_t j = i;
+		while (j+1 < sorted.size() && sorted[j+1] == sorted[j]+1)
+			j++;
+		if (!out.empty())
+			out += ",";
+		out += std::to_string(sorted[i]);
+		if (j > i)
+			out += "-" + std::to_string(sorted[j]);
+		i = j + 1;
+	}
+	return out;
+}
+
+std::vector<int> Numa::parse(const std::string& str)
+{
+	std::vector<int> cpus;
+	std::stringstream ss(str);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		size_t dash = range.find('-');
+		int first = std::stoi(range.substr(0, dash));
+		int last = dash == std::string::npos ? first : std::stoi(range.substr(dash+1));
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
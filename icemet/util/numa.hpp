@@ -0,0 +1,23 @@
+#ifndef ICEMET_NUMA_H
+#define ICEMET_NUMA_H
+
+#include <string>
+#include <vector>
+
+// NUMA nodes and their CPUs as listed in sysfs. Without NUMA information
+// all CPUs are on node 0.
+class Numa {
+public:
+	static int nodes();
+	static const std::vector<int>& cpus(int node);
+	static int node(int cpu);
+	
+	// Pin the calling thread to the CPUs
+	static bool bind(const std::vector<int>& cpus);
+	
+	// CPU list in the sysfs format, e.g. "0-3,8"
+	static std::string str(const std::vector<int>& cpus);
+	static std::vector<int> parse(const std::string& str);
+};
+
+#endif
@@ -39,3 +39,18 @@ std::string strfmt(const std::string& fmt, ...)
 	va_end(args);
 	return str;
 }
+
+std::string strnocolor(const std::string& str)
+{
+	std::string res;
+	for (size_t i = 0; i < str.size(); i++) {
+		if (str[i] == '\x1b') {
+			while (i < str.size() && str[i] != 'm')
+				i++;
+		}
+		else {
+			res += str[i];
+		}
+	}
+	return res;
+}
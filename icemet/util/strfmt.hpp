@@ -9,5 +9,6 @@ std::vector<char> vvecfmt(const std::string& fmt, va_list args);
 std::vector<char> vecfmt(const std::string& fmt, ...);
 std::string vstrfmt(const std::string& fmt, va_list args);
 std::string strfmt(const std::string& fmt, ...);
+std::string strnocolor(const std::string& str);
 
 #endif
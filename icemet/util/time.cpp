@@ -75,3 +75,9 @@ double Measure::time()
 	m_start = chr::high_resolution_clock::now();
 	return delta;
 }
+
+double Measure::elapsed() const
+{
+	auto now = chr::high_resolution_clock::now();
+	return chr::duration_cast<chr::microseconds>(now - m_start).count() / 1000000.0;
+}
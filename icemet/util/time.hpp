@@ -64,7 +64,9 @@ public:
 	Measure() : m_start(chr::high_resolution_clock::now()) {}
 	Measure(const Measure& m) : m_start(m.m_start) {}
 	
-	double time();
+	double time(); // Also restarts the measurement
+	double elapsed() const;
+	void reset() { m_start = chr::high_resolution_clock::now(); }
 };
 
 inline void ssleep(int s) { std::this_thread::sleep_for(chr::seconds(s)); }
@@ -0,0 +1,143 @@
+#include "trace.hpp"
+
+#include "icemet/util/strfmt.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#define TRACE_BUFFER_EVENTS 4096
+
+namespace chr = std::chrono;
+
+typedef struct _trace_event {
+	const char* name;
+	uint64_t ts;
+	uint64_t dur;
+	std::string file;
+} TraceEvent;
+
+static std::atomic<bool> traceEnabled(false);
+static std::atomic<int> traceThreads(0);
+static std::mutex traceMutex;
+static std::ofstream traceFile;
+static bool traceFirst = true;
+static chr::steady_clock::time_point traceStart;
+
+// Appends events to the file, called with traceMutex held
+static void traceWrite(const std::string& str)
+{
+	if (!traceFile.is_open())
+		return;
+	if (!traceFirst)
+		traceFile << ",\n";
+	traceFile << str;
+	traceFirst = false;
+}
+
+static std::string jsonEscape(const std::string& str)
+{
+	std::string res;
+	for (char c : str) {
+		if (c == '"' || c == '\\')
+			res += '\\';
+		res += c;
+	}
+	return res;
+}
+
+class TraceBuffer {
+public:
+	int tid;
+	std::vector<TraceEvent> events;
+	std::string file; // Current file tag
+	
+	TraceBuffer() : tid(++traceThreads) { events.reserve(TRACE_BUFFER_EVENTS); }
+	~TraceBuffer() { flush(); }
+	
+	void flush()
+	{
+		if (events.empty())
+			return;
+		std::string str;
+		for (size_t i = 0; i < events.size(); i++) {
+			const TraceEvent& e = events[i];
+			if (i)
+				str += ",\n";
+			str += strfmt(
+				"{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%d,\"args\":{\"file\":\"%s\"}}",
+				e.name, (unsigned long long)e.ts, (unsigned long long)e.dur, tid, jsonEscape(e.file).c_str()
+			);
+		}
+		events.clear();
+		
+		std::lock_guard<std::mutex> lock(traceMutex);
+		traceWrite(str);
+	}
+};
+
+static thread_local TraceBuffer traceBuffer;
+
+void Trace::start(const fs::path& fn)
+{
+	std::lock_guard<std::mutex> lock(traceMutex);
+	traceFile.open(fn);
+	if (!traceFile.is_open())
+		throw std::runtime_error(strfmt("Couldn't open trace file '%s'", fn.string().c_str()));
+	traceFile << "[\n";
+	traceFirst = true;
+	traceStart = chr::steady_clock::now();
+	traceEnabled.store(true);
+}
+
+void Trace::stop()
+{
+	if (!traceEnabled.exchange(false))
+		return;
+	traceBuffer.flush();
+	std::lock_guard<std::mutex> lock(traceMutex);
+	traceFile << "\n]\n";
+	traceFile.close();
+}
+
+bool Trace::enabled()
+{
+	return traceEnabled.load(std::memory_order_relaxed);
+}
+
+uint64_t Trace::now()
+{
+	return chr::duration_cast<chr::microseconds>(chr::steady_clock::now() - traceStart).count();
+}
+
+void Trace::setThreadName(const std::string& name)
+{
+	if (!enabled())
+		return;
+	std::string str = strfmt(
+		"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+		traceBuffer.tid, jsonEscape(strnocolor(name)).c_str()
+	);
+	std::lock_guard<std::mutex> lock(traceMutex);
+	traceWrite(str);
+}
+
+const std::string& Trace::file()
+{
+	return traceBuffer.file;
+}
+
+void Trace::setFile(const std::string& file)
+{
+	traceBuffer.file = file;
+}
+
+void Trace::record(const char* name, uint64_t ts, uint64_t dur, const std::string& file)
+{
+	traceBuffer.events.push_back({name, ts, dur, file});
+	if (traceBuffer.events.size() >= TRACE_BUFFER_EVENTS)
+		traceBuffer.flush();
+}
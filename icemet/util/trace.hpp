@@ -0,0 +1,71 @@
+#ifndef ICEMET_TRACE_H
+#define ICEMET_TRACE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace fs = std::filesystem;
+
+// Timeline of spans in Chrome trace-event format. Events are buffered per
+// thread and appended to the file in batches.
+class Trace {
+public:
+	static void start(const fs::path& fn);
+	static void stop();
+	static bool enabled();
+	static uint64_t now();
+	static void setThreadName(const std::string& name);
+	static const std::string& file();
+	static void setFile(const std::string& file);
+	static void record(const char* name, uint64_t ts, uint64_t dur, const std::string& file);
+};
+
+// Records the lifetime of the object as a span. Spans given a file name tag
+// the spans nested in them with it.
+class TraceSpan {
+private:
+	const char* m_name;
+	bool m_enabled;
+	bool m_tagged;
+	uint64_t m_start;
+	std::string m_file;
+	std::string m_prevFile;
+
+public:
+	TraceSpan(const char* name) :
+		m_name(name),
+		m_enabled(Trace::enabled()),
+		m_tagged(false),
+		m_start(0)
+	{
+		if (m_enabled) {
+			m_file = Trace::file();
+			m_start = Trace::now();
+		}
+	}
+	TraceSpan(const char* name, const std::string& file) :
+		m_name(name),
+		m_enabled(Trace::enabled()),
+		m_tagged(m_enabled),
+		m_start(0)
+	{
+		if (m_enabled) {
+			m_file = file;
+			m_prevFile = Trace::file();
+			Trace::setFile(file);
+			m_start = Trace::now();
+		}
+	}
+	TraceSpan(const TraceSpan& span) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+	~TraceSpan()
+	{
+		if (m_enabled)
+			Trace::record(m_name, m_start, Trace::now() - m_start, m_file);
+		if (m_tagged)
+			Trace::setFile(m_prevFile);
+	}
+};
+
+#endif
@@ -1,15 +1,53 @@
 #include "worker.hpp" 
 
+#include "icemet/core/config.hpp"
+#include "icemet/util/numa.hpp"
+#include "icemet/util/strfmt.hpp"
+#include "icemet/util/trace.hpp"
+
 #include <algorithm>
 #include <cstdlib>
 #include <exception>
 
+bool Worker::inputsClosed() const
+{
+	return std::all_of(m_inputs.begin(), m_inputs.end(), [](const auto& conn) {
+		return conn->closed();
+	});
+}
+
+void Worker::setReplica(int replica)
+{
+	m_name += strfmt("-%d", replica);
+	m_log = Log(m_name);
+	m_metrics.setName(m_name);
+}
+
+void Worker::setShard(int shard)
+{
+	m_name += strfmt("@%d", shard);
+	m_log = Log(m_name);
+	m_metrics.setName(m_name);
+}
+
 void Worker::run()
 {
 	m_log.debug("Running");
+	Trace::setThreadName(m_name);
+	if (!m_affinity.empty() && !Numa::bind(m_affinity))
+		m_log.warning("Couldn't pin to CPUs %s", Numa::str(m_affinity).c_str());
 	try {
+		allocate();
+		warmup();
+		m_ready = true;
 		if (init()) {
-			while (loop());
+			while (loop()) {
+				unsigned int version = ConfigStore::version();
+				if (version != m_cfgVersion) {
+					m_cfgVersion = version;
+					reconfigure();
+				}
+			}
 			close();
 		}
 	}
@@ -2,57 +2,166 @@
 #define ICEMET_WORKER_H
 
 #include "icemet/util/log.hpp"
+#include "icemet/util/metrics.hpp"
 #include "icemet/util/time.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
 class Worker;
 
+#define WORKER_CACHE_LINE 64
+
+// Bounded queue between workers. A queue linked to exactly one producer
+// and one consumer is a lock-free ring; otherwise every operation takes
+// the mutex.
 template<class T>
 class WorkerQueue {
 private:
 	std::queue<T> m_queue;
+	std::queue<chr::steady_clock::time_point> m_pushed;
 	std::mutex m_mutex;
 	size_t m_size;
+	QueueMetrics m_metrics;
+	std::vector<const void*> m_producers;
+	std::vector<const void*> m_consumers;
+	bool m_ring;
+	
+	// Ring slots indexed by the running push count modulo m_size
+	std::vector<T> m_slots;
+	std::vector<chr::steady_clock::time_point> m_stamps;
+	alignas(WORKER_CACHE_LINE) std::atomic<size_t> m_tail; // Written by the producer
+	size_t m_headCache; // Producer's view of m_head
+	alignas(WORKER_CACHE_LINE) std::atomic<size_t> m_head; // Written by the consumer
+	size_t m_tailCache; // Consumer's view of m_tail
 	
 	void lock() { m_mutex.lock(); }
 	void unlock() { m_mutex.unlock(); }
-
-public:
-	WorkerQueue(size_t size) : m_size(size) {}
 	
-	void push(const T& val)
+	void pushRing(T&& val)
+	{
+		// Wait until we have space
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_headCache >= m_size)
+			m_headCache = m_head.load(std::memory_order_acquire);
+		if (tail - m_headCache >= m_size) {
+			Measure m;
+			do {
+				msleep(1);
+				m_headCache = m_head.load(std::memory_order_acquire);
+			} while (tail - m_headCache >= m_size);
+			m_metrics.addBlocked(m.time());
+		}
+		
+		// Publish the slot
+		m_slots[tail % m_size] = std::move(val);
+		m_stamps[tail % m_size] = chr::steady_clock::now();
+		m_tail.store(tail + 1, std::memory_order_release);
+		m_metrics.setDepth(tail + 1 - m_headCache);
+	}
+	
+	void popRing(std::vector<T>& dst)
+	{
+		auto now = chr::steady_clock::now();
+		size_t head = m_head.load(std::memory_order_relaxed);
+		m_tailCache = m_tail.load(std::memory_order_acquire);
+		for (; head != m_tailCache; head++) {
+			T& slot = m_slots[head % m_size];
+			dst.push_back(std::move(slot));
+			slot = T();
+			m_metrics.observeWait(chr::duration<double>(now - m_stamps[head % m_size]).count());
+		}
+		m_head.store(head, std::memory_order_release);
+		m_metrics.setDepth(0);
+	}
+	
+	void put(T&& val)
 	{
+		if (m_ring) {
+			pushRing(std::move(val));
+			return;
+		}
+		
 		// Wait until we have space
+		Measure m;
+		bool blocked = false;
 		while (true) {
 			lock();
 			if (m_queue.size() < m_size)
 				break;
 			unlock();
+			blocked = true;
 			msleep(1);
 		}
 		
 		// Push to queue
-		m_queue.push(val);
+		m_queue.push(std::move(val));
+		m_pushed.push(chr::steady_clock::now());
+		m_metrics.setDepth(m_queue.size());
 		unlock();
+		if (blocked)
+			m_metrics.addBlocked(m.time());
 	}
+
+public:
+	WorkerQueue(size_t size, const std::string& name="") :
+		m_size(size),
+		m_metrics(name, size),
+		m_ring(false),
+		m_slots(size),
+		m_stamps(size),
+		m_tail(0),
+		m_headCache(0),
+		m_head(0),
+		m_tailCache(0) {}
+	WorkerQueue(const WorkerQueue& queue) = delete;
+	WorkerQueue& operator=(const WorkerQueue&) = delete;
+	
+	// Record a link. Links must be made before the workers are started.
+	void link(const void* producer, const void* consumer)
+	{
+		if (std::find(m_producers.begin(), m_producers.end(), producer) == m_producers.end())
+			m_producers.push_back(producer);
+		if (std::find(m_consumers.begin(), m_consumers.end(), consumer) == m_consumers.end())
+			m_consumers.push_back(consumer);
+		m_ring = m_producers.size() == 1 && m_consumers.size() == 1;
+	}
+	
+	bool ring() const { return m_ring; }
 	
-	void collect(std::queue<T>& dst)
+	void push(const T& val) { put(T(val)); }
+	void push(T&& val) { put(std::move(val)); }
+	
+	// Move all queued values to the end of dst
+	void popBatch(std::vector<T>& dst)
 	{
+		if (m_ring) {
+			popRing(dst);
+			return;
+		}
+		
+		auto now = chr::steady_clock::now();
 		lock();
 		while (!m_queue.empty()) {
-			dst.push(m_queue.front());
+			dst.push_back(std::move(m_queue.front()));
 			m_queue.pop();
+			m_metrics.observeWait(chr::duration<double>(now - m_pushed.front()).count());
+			m_pushed.pop();
 		}
+		m_metrics.setDepth(0);
 		unlock();
 	}
 	
 	bool full()
 	{
+		if (m_ring)
+			return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire) >= m_size;
+		
 		lock();
 		bool isFull = m_queue.size() >= m_size;
 		unlock();
@@ -61,6 +170,9 @@ public:
 	
 	bool empty()
 	{
+		if (m_ring)
+			return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+		
 		lock();
 		bool isEmpty = m_queue.empty();
 		unlock();
@@ -91,19 +203,46 @@ class Worker {
 protected:
 	std::string m_name;
 	Log m_log;
+	WorkerMetrics m_metrics;
 	
 	std::vector<WorkerConnection*> m_inputs;
 	std::vector<WorkerConnection*> m_outputs;
+	std::vector<int> m_affinity;
+	std::atomic<bool> m_ready;
+	unsigned int m_cfgVersion;
+	
+	bool inputsClosed() const;
 	
+	// Large buffers are allocated in the worker thread after it has been
+	// pinned, so their pages are first touched on the worker's NUMA node
+	virtual void allocate() {}
+	// A dummy frame through the stage compiles its OpenCL programs and
+	// fills the pools before the first real frame
+	virtual void warmup() {}
+	// Takes the current configuration version into use, called between
+	// frames after a reload
+	virtual void reconfigure() {}
 	virtual bool init() { return true; }
 	virtual bool loop() { return false; }
 	virtual void close() {}
 
 public:
-	Worker(const std::string& name) : m_name(name), m_log(name) {}
+	Worker(const std::string& name) : m_name(name), m_log(name), m_metrics(name), m_ready(false), m_cfgVersion(0) {}
 	void run();
+	const std::string& name() const { return m_name; }
+	bool ready() const { return m_ready; }
+	void setReplica(int replica);
+	void setShard(int shard);
+	void setAffinity(const std::vector<int>& cpus) { m_affinity = cpus; }
 	
 	static void connect(Worker* provider, Worker* user, void* data);
+	
+	template<class T>
+	static void connect(Worker* provider, Worker* user, WorkerQueue<T>* queue)
+	{
+		queue->link(provider, user);
+		connect(provider, user, static_cast<void*>(queue));
+	}
 };
 
 #endif
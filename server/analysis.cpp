@@ -2,6 +2,7 @@
 
 #include "icemet/core/math.hpp"
 #include "icemet/util/time.hpp"
+#include "icemet/util/trace.hpp"
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
@@ -9,32 +10,53 @@
 #include <algorithm>
 #include <cmath>
 #include <limits>
-#include <queue>
+#include <utility>
 
 #define AREA_MAX 0.70
 
-Analysis::Analysis(Config* cfg) :
+Analysis::Analysis(Config* cfg, ImagePool* pool) :
 	Worker(COLOR_CYAN "ANALYSIS" COLOR_RESET),
-	m_cfg(cfg) {}
+	m_cfg(cfg),
+	m_pool(pool),
+	m_grid(cfg->img.size) {}
+
+void Analysis::warmup()
+{
+	// Dark blurred disk in a segment
+	const int size = 64;
+	FilePtr file = cv::makePtr<File>();
+	file->param.bgVal = 128;
+	SegmentPtr segm = cv::makePtr<Segment>();
+	segm->z = m_cfg->particle.zMin;
+	segm->iter = 0;
+	segm->score = 0.0;
+	segm->method = cv::icemet::FOCUS_STD;
+	segm->rect = cv::Rect(m_cfg->img.border.width, m_cfg->img.border.height, size, size);
+	segm->img = cv::Mat(size, size, CV_8UC1, cv::Scalar(128));
+	cv::circle(segm->img, cv::Point(size/2, size/2), size/6, cv::Scalar(30), cv::FILLED);
+	cv::GaussianBlur(segm->img, segm->img, cv::Size(3, 3), 0);
+	file->segments.push_back(segm);
+	process(file);
+}
+
+void Analysis::reconfigure()
+{
+	m_cfg = ConfigStore::get();
+}
 
 bool Analysis::init()
 {
 	m_filesRecon = static_cast<FileQueue*>(m_inputs[0]->data);
+	m_filesSaver = static_cast<FileQueue*>(m_outputs[0]->data);
+	m_summaries = static_cast<SummaryQueue*>(m_outputs.back()->data);
 	return true;
 }
 
-bool Analysis::analyse(const FilePtr& file, const SegmentPtr& segm, ParticlePtr& par) const
+bool Analysis::measureContours(const SegmentPtr& segm, int th, const cv::Point& minLoc, cv::Mat& bufTh, cv::Mat& bufPar, double& area, double& perim, cv::Point2d& center, Mask& mask) const
 {
-	// Calculate threshold
-	double min, max;
-	cv::Point minLoc, maxLoc;
-	cv::minMaxLoc(segm->img, &min, &max, &minLoc, &maxLoc);
-	double bg = file->param.bgVal;
-	double f = m_cfg->particle.thFact;
-	int th = bg - f*(bg-min);
-	
 	// Apply threshold
-	cv::Mat imgTh;
+	const cv::Rect roi(cv::Point(0, 0), segm->img.size());
+	cv::Mat imgTh(bufTh, roi);
 	cv::threshold(segm->img, imgTh, th, 255, cv::THRESH_BINARY_INV);
 	
 	// Find contours
@@ -46,7 +68,6 @@ bool Analysis::analyse(const FilePtr& file, const SegmentPtr& segm, ParticlePtr&
 	
 	// Find the centermost contour
 	cv::Point_<double> origin(segm->rect.width/2.0, segm->rect.height/2.0);
-	cv::Point_<double> center;
 	double distMin = std::numeric_limits<double>::infinity();
 	int idx = 0;
 	for (int i = 0; i < n; i++) {
@@ -67,18 +88,76 @@ bool Analysis::analyse(const FilePtr& file, const SegmentPtr& segm, ParticlePtr&
 		return false;
 	
 	// Draw filled contour
-	cv::Mat imgPar = cv::Mat::zeros(imgTh.size(), CV_8UC1);
+	cv::Mat imgPar(bufPar, roi);
+	imgPar.setTo(0);
 	cv::drawContours(imgPar, contours, idx, 255, cv::FILLED);
 	
 	// Calculate area and perimeter
-	double area = cv::countNonZero(imgPar);
-	if (area > AREA_MAX*segm->rect.width*segm->rect.height)
+	area = cv::countNonZero(imgPar);
+	perim = cv::arcLength(contours[idx], true);
+	if (m_cfg->keeps.particles)
+		mask = Mask(imgPar);
+	return true;
+}
+
+bool Analysis::measureLabels(const SegmentPtr& segm, int th, const cv::Point& minLoc, double& area, double& perim, cv::Point2d& center, Mask& mask)
+{
+	m_labeler.label(segm->img, th);
+	const std::vector<int>& external = m_labeler.external();
+	if (external.empty()) return false;
+	
+	// Find the centermost component. Ties go to the last one in raster
+	// order, which findContours lists first.
+	cv::Point_<double> origin(segm->rect.width/2.0, segm->rect.height/2.0);
+	double distMin = std::numeric_limits<double>::infinity();
+	int idx = 0;
+	for (auto it = external.rbegin(); it != external.rend(); ++it) {
+		const cv::Rect& rect = m_labeler.comp(*it).rect;
+		cv::Point_<double> c(rect.x + rect.width/2.0, rect.y + rect.height/2.0);
+		double dx = origin.x - c.x;
+		double dy = origin.y - c.y;
+		double dist = sqrt(dx*dx + dy*dy);
+		if (dist < distMin) {
+			distMin = dist;
+			center = c;
+			idx = *it;
+		}
+	}
+	
+	// Check if the minimum is inside our component
+	if (m_labeler.component(minLoc) != idx)
+		return false;
+	
+	area = m_labeler.comp(idx).filled;
+	perim = m_labeler.perimeter(idx);
+	if (m_cfg->keeps.particles)
+		mask = m_labeler.mask(idx);
+	return true;
+}
+
+bool Analysis::analyse(const FilePtr& file, const SegmentPtr& segm, cv::Mat& bufTh, cv::Mat& bufPar, ParticlePtr& par)
+{
+	// Calculate threshold
+	double min, max;
+	cv::Point minLoc, maxLoc;
+	cv::minMaxLoc(segm->img, &min, &max, &minLoc, &maxLoc);
+	double bg = file->param.bgVal;
+	double f = m_cfg->particle.thFact;
+	int th = bg - f*(bg-min);
+	
+	// Measure the centermost particle
+	double area, perim;
+	cv::Point2d center;
+	Mask mask;
+	bool found = m_cfg->particle.labels ?
+		measureLabels(segm, th, minLoc, area, perim, center, mask) :
+		measureContours(segm, th, minLoc, bufTh, bufPar, area, perim, center, mask);
+	if (!found || area > AREA_MAX*segm->rect.width*segm->rect.height)
 		return false;
-	double perim = cv::arcLength(contours[idx], true);
 	
 	// Allocate particle
 	par = cv::makePtr<Particle>();
-	par->img = imgPar;
+	par->mask = std::move(mask);
 	par->effPxSz = m_cfg->hologram.psz / cv::icemet::Hologram::magnf(m_cfg->hologram.dist, segm->z);
 	
 	// Calculate diameter and apply correction
@@ -104,48 +183,40 @@ bool Analysis::analyse(const FilePtr& file, const SegmentPtr& segm, ParticlePtr&
 	return true;
 }
 
-void Analysis::process(FilePtr file)
+bool Analysis::better(const SegmentPtr& segm, const ParticlePtr& par, const SegmentPtr& segmOld, const ParticlePtr& parOld)
 {
-	// Sort by size
-	std::sort(file->segments.begin(), file->segments.end(), [](const auto& s1, const auto& s2) {
-		int A1 = s1->rect.width * s1->rect.height;
-		int A2 = s2->rect.width * s2->rect.height;
-		return A1 > A2;
-	});
-	
-	// Analyse all segments
-	std::vector<SegmentPtr> segments;
-	std::vector<ParticlePtr> particles;
-	for (const auto& segm : file->segments) {
-		ParticlePtr par;
-		if (analyse(file, segm, par)) {
-			segments.push_back(segm);
-			particles.push_back(par);
-		}
-	}
-	
-	// Find overlapping segments and select the best
-	std::vector<SegmentPtr> segmentsUnique;
-	std::vector<ParticlePtr> particlesUnique;
-	int ni = segments.size();
-	for (int i = 0; i < ni; i++) {
+	return (
+		(segm->iter == segmOld->iter && segm->rect.area() > segmOld->rect.area()) ||
+		(segm->iter != segmOld->iter && (
+			(segm->method == segmOld->method && segm->score > segmOld->score) ||
+			(segm->method != segmOld->method && par->dynRange > parOld->dynRange)
+		))
+	);
+}
+
+void Analysis::unique(const std::vector<SegmentPtr>& segments, const std::vector<ParticlePtr>& particles, std::vector<SegmentPtr>& segmentsUnique, std::vector<ParticlePtr>& particlesUnique)
+{
+	// Unique segments are indexed in a grid so each segment is only compared
+	// to the ones near it. The first overlapping unique segment is replaced
+	// if the new one is better.
+	m_grid.clear();
+	std::vector<int> candidates;
+	int n = segments.size();
+	for (int i = 0; i < n; i++) {
 		const auto& segm = segments[i];
 		const auto& par = particles[i];
 		
 		bool found = false;
-		int nj = segmentsUnique.size();
-		for (int j = 0; j < nj; j++) {
+		m_grid.query(segm->rect, candidates);
+		for (int j : candidates) {
 			const auto& segmOld = segmentsUnique[j];
 			const auto& parOld = particlesUnique[j];
 			
 			// Check overlap
 			if ((segm->rect & segmOld->rect).area() > 0) {
-				// Decide the better particle
-				if ((segm->iter == segmOld->iter && segm->rect.area() > segmOld->rect.area()) ||
-				    (segm->iter != segmOld->iter && (
-						(segm->method == segmOld->method && segm->score > segmOld->score) ||
-						(segm->method != segmOld->method && par->dynRange > parOld->dynRange)
-					))) {
+				if (better(segm, par, segmOld, parOld)) {
+					m_grid.remove(j, segmOld->rect);
+					m_grid.insert(j, segm->rect);
 					segmentsUnique[j] = segm;
 					particlesUnique[j] = par;
 				}
@@ -154,13 +225,52 @@ void Analysis::process(FilePtr file)
 			}
 		}
 		if (!found) {
+			m_grid.insert(segmentsUnique.size(), segm->rect);
 			segmentsUnique.push_back(segm);
 			particlesUnique.push_back(par);
 		}
 	}
+}
+
+void Analysis::process(FilePtr file)
+{
+	// Sort by size
+	std::sort(file->segments.begin(), file->segments.end(), [](const auto& s1, const auto& s2) {
+		int A1 = s1->rect.width * s1->rect.height;
+		int A2 = s2->rect.width * s2->rect.height;
+		return A1 > A2;
+	});
+	
+	// Analyse all segments
+	cv::Mat bufTh = m_pool->getMat(m_cfg->img.size, CV_8UC1);
+	cv::Mat bufPar = m_pool->getMat(m_cfg->img.size, CV_8UC1);
+	std::vector<SegmentPtr> segments;
+	std::vector<ParticlePtr> particles;
+	{
+		TraceSpan span("analyse");
+		for (const auto& segm : file->segments) {
+			ParticlePtr par;
+			if (analyse(file, segm, bufTh, bufPar, par)) {
+				segments.push_back(segm);
+				particles.push_back(par);
+			}
+		}
+	}
+	
+	// Find overlapping segments and select the best
+	std::vector<SegmentPtr> segmentsUnique;
+	std::vector<ParticlePtr> particlesUnique;
+	{
+		TraceSpan span("unique");
+		unique(segments, particles, segmentsUnique, particlesUnique);
+	}
 	
 	file->segments = segmentsUnique;
 	file->particles = particlesUnique;
+	if (!m_cfg->keeps.segments) {
+		for (const auto& segm : file->segments)
+			segm->img.release();
+	}
 	int count = file->particles.size();
 	file->setStatus(count ? FILE_STATUS_NOTEMPTY : FILE_STATUS_EMPTY);
 	m_log.debug("Particles: %d", count);
@@ -169,22 +279,28 @@ void Analysis::process(FilePtr file)
 bool Analysis::loop()
 {
 	// Collect files
-	std::queue<FilePtr> files;
-	m_filesRecon->collect(files);
+	m_filesRecon->popBatch(m_batch);
 	
 	// Process
-	while (!files.empty()) {
-		FilePtr file = files.front();
+	for (auto& file : m_batch) {
 		if (file->status() == FILE_STATUS_NONE) {
 			m_log.debug("Analysing %s", file->name().c_str());
+			TraceSpan span("analysis", file->name());
 			Measure m;
+			unsigned int allocs = ImagePool::threadAllocs();
 			process(file);
-			m_log.debug("Done %s (%.2f s)", file->name().c_str(), m.time());
+			file->param.allocs += ImagePool::threadAllocs() - allocs;
+			double t = m.time();
+			m_metrics.observe(t);
+			m_log.debug("Done %s (%.2f s, %.2f MB)", file->name().c_str(), t, file->memory()/1000000.0);
 		}
-		for (const auto& conn : m_outputs)
-			static_cast<FileQueue*>(conn->data)->push(file);
-		files.pop();
+		
+		// Stats only gets the particle properties so the images are freed
+		// as soon as the Saver is done
+		m_summaries->push(file->summary());
+		m_filesSaver->push(std::move(file));
 	}
+	m_batch.clear();
 	msleep(1);
-	return !m_inputs[0]->closed() || !m_filesRecon->empty();
+	return !inputsClosed() || !m_filesRecon->empty();
 }
@@ -4,20 +4,36 @@
 #include "icemet/worker.hpp"
 #include "icemet/core/config.hpp"
 #include "icemet/core/file.hpp"
+#include "icemet/core/grid.hpp"
+#include "icemet/core/label.hpp"
+#include "icemet/core/pool.hpp"
 
 #include <vector>
 
 class Analysis : public Worker {
 protected:
 	Config* m_cfg;
+	ImagePool* m_pool;
 	FileQueue* m_filesRecon;
-	bool analyse(const FilePtr& file, const SegmentPtr& segm, ParticlePtr& par) const;
+	FileQueue* m_filesSaver;
+	SummaryQueue* m_summaries;
+	std::vector<FilePtr> m_batch;
+	RectGrid m_grid;
+	Labeler m_labeler;
+	
+	static bool better(const SegmentPtr& segm, const ParticlePtr& par, const SegmentPtr& segmOld, const ParticlePtr& parOld);
+	void unique(const std::vector<SegmentPtr>& segments, const std::vector<ParticlePtr>& particles, std::vector<SegmentPtr>& segmentsUnique, std::vector<ParticlePtr>& particlesUnique);
+	bool measureContours(const SegmentPtr& segm, int th, const cv::Point& minLoc, cv::Mat& bufTh, cv::Mat& bufPar, double& area, double& perim, cv::Point2d& center, Mask& mask) const;
+	bool measureLabels(const SegmentPtr& segm, int th, const cv::Point& minLoc, double& area, double& perim, cv::Point2d& center, Mask& mask);
+	bool analyse(const FilePtr& file, const SegmentPtr& segm, cv::Mat& bufTh, cv::Mat& bufPar, ParticlePtr& par);
 	void process(FilePtr file);
+	void warmup() override;
+	void reconfigure() override;
 	bool init() override;
 	bool loop() override;
 
 public:
-	Analysis(Config* cfg);
+	Analysis(Config* cfg, ImagePool* pool);
 };
 
 #endif
@@ -0,0 +1,139 @@
+#include "batch.hpp"
+
+#include "icemet/util/time.hpp"
+#include "server/watcher.hpp"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <atomic>
+
+Batch::Batch(Config* cfg, Database* db, int shards) :
+	m_cfg(cfg),
+	m_log("BATCH"),
+	m_summaries(cfg->pipeline.stats.queue, "analysis_stats")
+{
+	// Shards would overwrite each other's checkpoints
+	if (!m_cfg->state.dir.empty()) {
+		m_log.warning("Checkpoints are disabled in batch mode");
+		m_cfg->state.dir.clear();
+	}
+	
+	std::vector<FilePtr> files = Watcher::list(m_cfg->paths.watch, m_log);
+	int n = files.size();
+	shards = std::max(std::min(shards, n), 1);
+	
+	// Frames before a shard fill the background subtraction stack and the
+	// ones after it push the last frames of the shard through. Frames that
+	// fail the dynamic range check of the original never enter the stack, so
+	// the context reaches as far as needed to find enough frames that do.
+	int lead = m_cfg->bgsub.enabled ? m_cfg->bgsub.stackLen : 0;
+	int trail = m_cfg->bgsub.enabled ? m_cfg->bgsub.stackLen / 2 : 0;
+	std::vector<std::atomic<signed char>> stacked(n);
+	for (auto& val : stacked)
+		val = -1;
+	auto enters = [&](int i) {
+		signed char val = stacked[i];
+		if (val < 0) {
+			val = entersStack(files[i]);
+			stacked[i] = val;
+		}
+		return val > 0;
+	};
+	
+	// The shard boundaries are searched in parallel. Neighbouring shards may
+	// both decode a frame between them, which only costs time.
+	std::vector<int> begins(shards), ends(shards);
+	cv::parallel_for_(cv::Range(0, shards), [&](const cv::Range& range) {
+		for (int s = range.start; s < range.end; s++) {
+			int first = (long long)n * s / shards;
+			int last = (long long)n * (s+1) / shards;
+			int begin = first;
+			int end = last;
+			if (first < last) {
+				for (int k = 0; begin > 0 && k < lead; begin--)
+					k += enters(begin-1);
+				for (int k = 0; end < n && k < trail; end++)
+					k += enters(end);
+			}
+			begins[s] = begin;
+			ends[s] = end;
+		}
+	});
+	
+	std::vector<bool> shared(n, false);
+	auto context = [&](int i) {
+		FilePtr file = cv::makePtr<File>(files[i]->path());
+		file->param.context = true;
+		shared[i] = true;
+		return file;
+	};
+	
+	m_stats = cv::makePtr<Stats>(cfg, db);
+	for (int s = 0; s < shards; s++) {
+		int first = (long long)n * s / shards;
+		int last = (long long)n * (s+1) / shards;
+		std::vector<FilePtr> shard;
+		for (int i = begins[s]; i < first; i++)
+			shard.push_back(context(i));
+		for (int i = first; i < last; i++)
+			shard.push_back(files[i]);
+		for (int i = last; i < ends[s]; i++)
+			shard.push_back(context(i));
+		
+		m_pipelines.push_back(cv::makePtr<Pipeline>(cfg, db, s+1));
+		m_pipelines.back()->setFiles(shard, first);
+		m_pipelines.back()->share(m_stats.get(), &m_summaries);
+		m_log.info(
+			"Shard %d: %d files from %s (%d context)",
+			s+1, last-first, first < last ? files[first]->name().c_str() : "-", (int)shard.size()-(last-first)
+		);
+	}
+	
+	// The owning shard keeps the shared originals in place
+	for (int i = 0; i < n; i++) {
+		if (shared[i]) {
+			files[i]->param.shared = true;
+			m_shared.push_back(files[i]);
+		}
+	}
+}
+
+bool Batch::entersStack(const FilePtr& file) const
+{
+	// Same check as Preproc does before pushing the frame
+	cv::Mat img = cv::imread(file->path().string(), cv::IMREAD_GRAYSCALE);
+	if (img.empty())
+		return false;
+	double minVal, maxVal;
+	cv::minMaxLoc(img, &minVal, &maxVal);
+	return maxVal - minVal >= m_cfg->emptyCheck.originalTh;
+}
+
+void Batch::start()
+{
+	// Shards warm up at the same time
+	for (const auto& pipeline : m_pipelines)
+		pipeline->launch();
+	while (!std::all_of(m_pipelines.begin(), m_pipelines.end(), [](const cv::Ptr<Pipeline>& pipeline) { return pipeline->ready(); }))
+		msleep(10);
+	for (const auto& pipeline : m_pipelines)
+		pipeline->run();
+	m_stats->setAffinity(m_cfg->pipeline.stats.affinity);
+	m_statsThread = std::thread(&Worker::run, m_stats.get());
+}
+
+void Batch::join()
+{
+	for (const auto& pipeline : m_pipelines)
+		pipeline->join();
+	if (m_statsThread.joinable())
+		m_statsThread.join();
+	
+	// Remove the shared originals the Savers are done with
+	for (const auto& file : m_shared) {
+		if (file->param.released)
+			fs::remove(file->path());
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef ICEMET_SERVER_BATCH_H
+#define ICEMET_SERVER_BATCH_H
+
+#include "icemet/core/config.hpp"
+#include "icemet/core/database.hpp"
+#include "icemet/core/file.hpp"
+#include "icemet/util/log.hpp"
+#include "server/pipeline.hpp"
+#include "server/stats.hpp"
+
+#include <thread>
+#include <vector>
+
+// Offline reprocessing of the watched files in contiguous time shards, each
+// running its own pipeline. Shards also read the neighbouring frames needed
+// by the background subtraction and send their summaries to one Stats in the
+// original order, so the results match a single pipeline.
+class Batch {
+private:
+	Config* m_cfg;
+	Log m_log;
+	SummaryQueue m_summaries;
+	cv::Ptr<Stats> m_stats;
+	std::vector<cv::Ptr<Pipeline>> m_pipelines;
+	std::vector<FilePtr> m_shared; // Originals read by two shards
+	std::thread m_statsThread;
+	
+	bool entersStack(const FilePtr& file) const;
+
+public:
+	Batch(Config* cfg, Database* db, int shards);
+	Batch(const Batch& batch) = delete;
+	Batch& operator=(const Batch&) = delete;
+	
+	void start();
+	void join();
+};
+
+#endif
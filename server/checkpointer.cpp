@@ -0,0 +1,67 @@
+#include "checkpointer.hpp"
+
+#include "icemet/util/time.hpp"
+#include "icemet/util/trace.hpp"
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+
+Checkpointer::Checkpointer(Config* cfg) :
+	Worker(COLOR_GREEN "CHECKPOINTER" COLOR_RESET),
+	m_cfg(cfg),
+	m_history(0) {}
+
+size_t Checkpointer::queueSize(const Config* cfg)
+{
+	// A popped batch and a full queue
+	return std::max<size_t>(1, cfg->bgsub.stackLen/4);
+}
+
+bool Checkpointer::init()
+{
+	m_checkpoints = static_cast<CheckpointQueue*>(m_inputs[0]->data);
+	
+	// Keep the stack frames of every file that may still be in flight, so
+	// the unfinished files can be redone after a restart
+	const PipelineParam& p = m_cfg->pipeline;
+	size_t stackLen = m_cfg->bgsub.stackLen;
+	m_history = stackLen + stackLen/2 + 1 +
+		p.recon.queue*(1+p.recon.replicas) +
+		p.analysis.queue*(1+p.analysis.replicas) +
+		p.saver.queue*(1+p.saver.replicas) +
+		p.stats.queue + p.analysis.replicas;
+	return true;
+}
+
+void Checkpointer::write(const Checkpoint& checkpoint)
+{
+	// Written under a temporary name so only complete frames are restored
+	if (!checkpoint.img.empty()) {
+		TraceSpan span("checkpoint");
+		fs::path tmp = checkpoint.path.parent_path() / fs::path("tmp.png");
+		cv::imwrite(tmp.string(), checkpoint.img, {cv::IMWRITE_PNG_COMPRESSION, 1});
+		fs::rename(tmp, checkpoint.path);
+	}
+	m_frames.push_back(checkpoint.path);
+	while (m_frames.size() > m_history) {
+		fs::remove(m_frames.front());
+		m_frames.pop_front();
+	}
+}
+
+bool Checkpointer::loop()
+{
+	// Collect frames
+	m_checkpoints->popBatch(m_batch);
+	
+	// Write
+	for (const auto& checkpoint : m_batch) {
+		Measure m;
+		write(checkpoint);
+		m_metrics.observe(m.time());
+	}
+	m_batch.clear();
+	msleep(1);
+	return !inputsClosed() || !m_checkpoints->empty();
+}
@@ -0,0 +1,43 @@
+#ifndef ICEMET_SERVER_CHECKPOINTER_H
+#define ICEMET_SERVER_CHECKPOINTER_H
+
+#include "icemet/worker.hpp"
+#include "icemet/core/config.hpp"
+
+#include <opencv2/core.hpp>
+
+#include <deque>
+#include <vector>
+
+// A preprocessed frame to keep for a restart. Frames that are already on
+// disk, restored from the previous run, come without an image.
+typedef struct _checkpoint {
+	fs::path path;
+	cv::Mat img;
+} Checkpoint;
+
+typedef WorkerQueue<Checkpoint> CheckpointQueue;
+
+// Writes the background subtraction stack frames of Preproc to the state
+// directory and removes the ones no longer needed
+class Checkpointer : public Worker {
+protected:
+	Config* m_cfg;
+	CheckpointQueue* m_checkpoints;
+	std::vector<Checkpoint> m_batch;
+	size_t m_history; // Frames kept in the state directory
+	std::deque<fs::path> m_frames;
+	
+	void write(const Checkpoint& checkpoint);
+	bool init() override;
+	bool loop() override;
+
+public:
+	Checkpointer(Config* cfg);
+	
+	// Frames waiting to be written stay within the half stack a file is
+	// ahead of when it leaves Preproc
+	static size_t queueSize(const Config* cfg);
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "exporter.hpp"
+
+#include "icemet/util/metrics.hpp"
+#include "icemet/util/strfmt.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+
+Exporter::Exporter(Config* cfg) :
+	Worker(COLOR_BRIGHT_BLUE "EXPORTER" COLOR_RESET),
+	m_cfg(cfg),
+	m_stop(false),
+	m_sock(-1) {}
+
+bool Exporter::init()
+{
+	const int port = m_cfg->metrics.port;
+	if (port > 0) {
+		m_sock = socket(AF_INET, SOCK_STREAM, 0);
+		int opt = 1;
+		setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (m_sock < 0 || bind(m_sock, (sockaddr*)&addr, sizeof(addr)) || listen(m_sock, 4))
+			throw std::runtime_error(strfmt("Couldn't listen on metrics port %d", port));
+		m_log.info("Metrics on http://127.0.0.1:%d/metrics", port);
+	}
+	if (!m_cfg->metrics.file.empty())
+		m_log.info("Metrics to %s", m_cfg->metrics.file.string().c_str());
+	update();
+	return true;
+}
+
+void Exporter::update()
+{
+	m_text = Metrics::text();
+	m_last.reset();
+	
+	// Replace the file atomically so readers never see a partial one
+	const fs::path& fn = m_cfg->metrics.file;
+	if (!fn.empty()) {
+		fs::path tmp(fn.string() + ".tmp");
+		std::ofstream f(tmp);
+		f << m_text;
+		f.close();
+		std::error_code ec;
+		fs::rename(tmp, fn, ec);
+		if (ec)
+			m_log.warning("Couldn't write metrics file: %s", ec.message().c_str());
+	}
+}
+
+void Exporter::serve()
+{
+	pollfd pfd = {m_sock, POLLIN, 0};
+	if (poll(&pfd, 1, 100) <= 0)
+		return;
+	int conn = accept(m_sock, NULL, NULL);
+	if (conn < 0)
+		return;
+	
+	// The request itself doesn't matter, every path returns the metrics
+	char buf[1024];
+	pfd = {conn, POLLIN, 0};
+	if (poll(&pfd, 1, 100) > 0)
+		(void)!read(conn, buf, sizeof(buf));
+	std::string resp = strfmt(
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\n"
+		"\r\n", m_text.size()
+	) + m_text;
+	(void)!write(conn, resp.c_str(), resp.size());
+	::close(conn);
+}
+
+bool Exporter::loop()
+{
+	if (m_last.elapsed() >= m_cfg->metrics.interval)
+		update();
+	if (m_sock >= 0)
+		serve();
+	else
+		msleep(100);
+	return !m_stop.load();
+}
+
+void Exporter::close()
+{
+	update();
+	if (m_sock >= 0)
+		::close(m_sock);
+}
@@ -0,0 +1,32 @@
+#ifndef ICEMET_SERVER_EXPORTER_H
+#define ICEMET_SERVER_EXPORTER_H
+
+#include "icemet/worker.hpp"
+#include "icemet/core/config.hpp"
+
+#include <atomic>
+#include <string>
+
+// Writes the metrics of all workers and queues periodically in Prometheus
+// text format and serves them on a local HTTP port.
+class Exporter : public Worker {
+protected:
+	Config* m_cfg;
+	std::atomic<bool> m_stop;
+	int m_sock;
+	Measure m_last;
+	std::string m_text;
+	
+	void update();
+	void serve();
+	bool init() override;
+	bool loop() override;
+	void close() override;
+
+public:
+	Exporter(Config* cfg);
+	
+	void stop() { m_stop.store(true); }
+};
+
+#endif
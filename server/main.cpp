@@ -1,16 +1,15 @@
 #include "icemet/core/database.hpp"
 #include "icemet/util/log.hpp"
 #include "icemet/util/strfmt.hpp"
-#include "server/analysis.hpp"
-#include "server/preproc.hpp"
-#include "server/reader.hpp"
-#include "server/recon.hpp"
-#include "server/saver.hpp"
-#include "server/stats.hpp"
-#include "server/watcher.hpp"
+#include "icemet/util/trace.hpp"
+#include "server/batch.hpp"
+#include "server/exporter.hpp"
+#include "server/pipeline.hpp"
+#include "server/reloader.hpp"
 
 #include <opencv2/core/ocl.hpp>
 
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <exception>
@@ -26,6 +25,8 @@ static const char* helpStr =
 "  -V                Print version info and exit\n"
 "  -s                Stats only. Particles will be fetched from the database.\n"
 "  -Q                Quit after processing all available files.\n"
+"  -j N              Process the available files in N parallel time shards.\n"
+"                    Implies -Q.\n"
 "  -d                Enable debug messages.\n";
 static const char* versionStr =
 "ICEMET Server " ICEMET_VERSION "\n"
@@ -64,6 +65,14 @@ int main(int argc, char* argv[])
 			else if (!arg.compare("-Q")) {
 				args.waitNew = false;
 			}
+			else if (!arg.compare("-j") && i+1 < argc) {
+				args.shards = atoi(argv[++i]);
+				args.waitNew = false;
+				if (args.shards < 1) {
+					printf("Invalid shard count '%s'\n", argv[i]);
+					return EXIT_FAILURE;
+				}
+			}
 			else if (!arg.compare("-d")) {
 				args.loglevel = LOG_DEBUG;
 			}
@@ -80,6 +89,10 @@ int main(int argc, char* argv[])
 		printf(usageStr);
 		return EXIT_FAILURE;
 	}
+	if (args.statsOnly && args.shards > 1) {
+		printf("Options -s and -j can't be combined\n");
+		return EXIT_FAILURE;
+	}
 	
 	Log log("MAIN");
 	try {
@@ -92,7 +105,15 @@ int main(int argc, char* argv[])
 		// Setup logging
 		Log::setLevel(args.loglevel);
 		
-		// Initialize OpenCL
+		// Initialize OpenCL. Compiled programs are cached between runs.
+		std::vector<char> cacheVec;
+		if (!cfg.ocl.cache.empty()) {
+			fs::create_directories(cfg.ocl.cache);
+			cacheVec = vecfmt("OPENCV_OPENCL_CACHE_DIR=%s", cfg.ocl.cache.string().c_str());
+			if (putenv(&cacheVec[0]))
+				throw std::runtime_error("Couldn't set the OpenCL cache");
+			log.info("OpenCL cache %s", cfg.ocl.cache.string().c_str());
+		}
 		const char* device = cfg.ocl.device.c_str();
 		std::vector<char> vec = vecfmt("OPENCV_OPENCL_DEVICE=%s", device);
 		if (putenv(&vec[0]) || !cv::ocl::useOpenCL())
@@ -105,48 +126,41 @@ int main(int argc, char* argv[])
 		log.info("Particle table '%s'", cfg.dbInfo.particleTable.c_str());
 		log.info("Stats table '%s'", cfg.dbInfo.statsTable.c_str());
 		
-		// Create workers
-		Watcher watcher(&cfg);
-		Reader reader(&cfg, &db);
-		Preproc preproc(&cfg);
-		Recon recon(&cfg);
-		Analysis analysis(&cfg);
-		Saver saver(&cfg, &db);
-		Stats stats(&cfg, &db);
+		// Export metrics until all the other workers are done
+		Exporter exporter(&cfg);
+		std::thread exporterThread;
+		if (!cfg.metrics.file.empty() || cfg.metrics.port > 0)
+			exporterThread = std::thread(&Exporter::run, &exporter);
+		
+		// Reload the parameters that can change between frames on SIGHUP
+		ConfigStore::start(&cfg);
+		Reloader reloader(&cfg);
+		std::thread reloaderThread(&Reloader::run, &reloader);
+		std::signal(SIGHUP, Reloader::hangup);
 		
-		// Create data queues
-		FileQueue filesOriginal(4);
-		FileQueue filesPreproc(2);
-		FileQueue filesRecon(2);
-		FileQueue filesAnalysisSaver(2);
-		FileQueue filesAnalysisStats(2);
+		// Record a timeline
+		if (!cfg.metrics.trace.empty()) {
+			Trace::start(cfg.metrics.trace);
+			log.info("Tracing to %s", cfg.metrics.trace.string().c_str());
+		}
 		
 		// Launch worker threads
-		std::vector<std::thread> threads;
-		if (!args.statsOnly) {
-			Worker::connect(&watcher, &preproc, &filesOriginal);
-			Worker::connect(&preproc, &recon, &filesPreproc);
-			Worker::connect(&recon, &analysis, &filesRecon);
-			Worker::connect(&analysis, &saver, &filesAnalysisSaver);
-			Worker::connect(&analysis, &stats, &filesAnalysisStats);
-			
-			threads.push_back(std::thread(&Watcher::run, &watcher));
-			threads.push_back(std::thread(&Preproc::run, &preproc));
-			threads.push_back(std::thread(&Recon::run, &recon));
-			threads.push_back(std::thread(&Analysis::run, &analysis));
-			threads.push_back(std::thread(&Saver::run, &saver));
-			threads.push_back(std::thread(&Stats::run, &stats));
+		if (args.shards > 1) {
+			Batch batch(&cfg, &db, args.shards);
+			batch.start();
+			batch.join();
 		}
 		else {
-			Worker::connect(&reader, &stats, &filesAnalysisStats);
-			
-			threads.push_back(std::thread(&Reader::run, &reader));
-			threads.push_back(std::thread(&Stats::run, &stats));
+			Pipeline pipeline(&cfg, &db);
+			pipeline.start();
+			pipeline.join();
 		}
-		
-		// Join threads
-		for (auto it = threads.begin(); it != threads.end(); ++it)
-			it->join();
+		exporter.stop();
+		if (exporterThread.joinable())
+			exporterThread.join();
+		reloader.stop();
+		reloaderThread.join();
+		Trace::stop();
 		log.info("Done");
 	}
 	catch (std::exception& e) {
@@ -0,0 +1,209 @@
+#include "pipeline.hpp"
+
+#include "icemet/util/numa.hpp"
+#include "icemet/util/strfmt.hpp"
+#include "icemet/util/time.hpp"
+#include "server/realtime.hpp"
+
+#include <algorithm>
+#include <string>
+
+// Names of the workers and queues of a shard end with "@shard"
+static std::string shardName(const std::string& name, int shard)
+{
+	return shard > 0 ? strfmt("%s@%d", name.c_str(), shard) : name;
+}
+
+template<class T, class F>
+static void replicate(std::vector<cv::Ptr<T>>& workers, int n, int shard, Config* cfg, F arg)
+{
+	for (int i = 0; i < n; i++) {
+		workers.push_back(cv::makePtr<T>(cfg, arg(i)));
+		if (n > 1)
+			workers.back()->setReplica(i+1);
+		if (shard > 0)
+			workers.back()->setShard(shard);
+	}
+}
+
+Pipeline::Pipeline(Config* cfg, Database* db, int shard) :
+	m_cfg(cfg),
+	m_shard(shard),
+	m_log(shardName("PIPELINE", shard)),
+	m_statsWorker(NULL),
+	m_filesOriginal(cfg->pipeline.preproc.queue, shardName("original", shard)),
+	m_filesPreproc(cfg->pipeline.recon.queue, shardName("preproc", shard)),
+	m_checkpoints(Checkpointer::queueSize(cfg), shardName("checkpoint", shard)),
+	m_filesRecon(cfg->pipeline.analysis.queue, shardName("recon", shard)),
+	m_filesAnalysisSaver(cfg->pipeline.saver.queue, shardName("analysis_saver", shard)),
+	m_summaries(cfg->pipeline.stats.queue, shardName("analysis_stats", shard)),
+	m_statsQueue(&m_summaries)
+{
+	const PipelineParam& p = m_cfg->pipeline;
+	if (!m_cfg->args.statsOnly) {
+		m_watcher = cv::makePtr<Watcher>(cfg, pool(p.watcher));
+		m_preproc = cv::makePtr<Preproc>(cfg, pool(p.preproc));
+		if (m_shard > 0) {
+			m_watcher->setShard(m_shard);
+			m_preproc->setShard(m_shard);
+		}
+		if (m_cfg->bgsub.enabled && !m_cfg->state.dir.empty()) {
+			m_checkpointer = cv::makePtr<Checkpointer>(cfg);
+			if (m_shard > 0)
+				m_checkpointer->setShard(m_shard);
+		}
+		replicate(m_recon, p.recon.replicas, m_shard, cfg, [&](int i) { return pool(p.recon, i); });
+		replicate(m_analysis, p.analysis.replicas, m_shard, cfg, [&](int i) { return pool(p.analysis, i); });
+		replicate(m_saver, p.saver.replicas, m_shard, cfg, [=](int) { return db; });
+		m_log.info("Replicas: recon %d, analysis %d, saver %d", p.recon.replicas, p.analysis.replicas, p.saver.replicas);
+		
+		// Shedding only makes sense for frames that keep arriving
+		if (m_cfg->realtime.enabled && m_cfg->args.waitNew)
+			Realtime::start(m_cfg->realtime, p.recon.replicas);
+	}
+	else {
+		m_reader = cv::makePtr<Reader>(cfg, db);
+	}
+	
+	// Shards share the Stats of the batch
+	if (m_shard == 0) {
+		m_stats = cv::makePtr<Stats>(cfg, db);
+		m_statsWorker = m_stats.get();
+	}
+}
+
+void Pipeline::setFiles(const std::vector<FilePtr>& files, unsigned int seq)
+{
+	m_watcher->setFiles(files, seq);
+}
+
+void Pipeline::share(Worker* stats, SummaryQueue* summaries)
+{
+	m_statsWorker = stats;
+	m_statsQueue = summaries;
+}
+
+std::vector<int> Pipeline::stageCpus(const StageParam& stage, int replica)
+{
+	if (stage.affinityAuto)
+		return Numa::cpus(replica % Numa::nodes());
+	return stage.affinity;
+}
+
+ImagePool* Pipeline::pool(const StageParam& stage, int replica)
+{
+	// Workers pinned to a single node recycle buffers only among themselves,
+	// so a buffer stays on the node that first touched it
+	std::vector<int> cpus = stageCpus(stage, replica);
+	if (cpus.empty())
+		return &m_pool;
+	int node = Numa::node(cpus[0]);
+	if (node < 0)
+		return &m_pool;
+	for (int cpu : cpus) {
+		if (Numa::node(cpu) != node)
+			return &m_pool;
+	}
+	if (m_nodePools.empty())
+		m_nodePools.resize(Numa::nodes());
+	cv::Ptr<ImagePool>& nodePool = m_nodePools[node];
+	if (nodePool.empty())
+		nodePool = cv::makePtr<ImagePool>();
+	return nodePool.get();
+}
+
+void Pipeline::launch(Worker* worker, const StageParam& stage, int replica)
+{
+	// The worker pins itself before allocating anything
+	std::vector<int> cpus = stageCpus(stage, replica);
+	worker->setAffinity(cpus);
+	
+	if (cpus.empty()) {
+		m_log.info("%s: any CPU", worker->name().c_str());
+	}
+	else {
+		std::vector<int> nodes;
+		for (int cpu : cpus)
+			nodes.push_back(Numa::node(cpu));
+		m_log.info("%s: CPUs %s, node %s", worker->name().c_str(), Numa::str(cpus).c_str(), Numa::str(nodes).c_str());
+	}
+	m_threads.push_back(std::thread(&Worker::run, worker));
+}
+
+void Pipeline::launch()
+{
+	const PipelineParam& p = m_cfg->pipeline;
+	if (!m_cfg->args.statsOnly) {
+		Worker::connect(m_watcher.get(), m_preproc.get(), &m_filesOriginal);
+		for (const auto& recon : m_recon) {
+			Worker::connect(m_preproc.get(), recon.get(), &m_filesPreproc);
+			for (const auto& analysis : m_analysis)
+				Worker::connect(recon.get(), analysis.get(), &m_filesRecon);
+		}
+		if (!m_checkpointer.empty())
+			Worker::connect(m_preproc.get(), m_checkpointer.get(), &m_checkpoints);
+		
+		// Analysis outputs are the Saver connections followed by Stats
+		for (const auto& analysis : m_analysis) {
+			for (const auto& saver : m_saver)
+				Worker::connect(analysis.get(), saver.get(), &m_filesAnalysisSaver);
+			Worker::connect(analysis.get(), m_statsWorker, m_statsQueue);
+		}
+		
+		launch(m_preproc.get(), p.preproc);
+		if (!m_checkpointer.empty())
+			launch(m_checkpointer.get(), p.saver); // Disk I/O like the Saver
+		for (size_t i = 0; i < m_recon.size(); i++)
+			launch(m_recon[i].get(), p.recon, i);
+		for (size_t i = 0; i < m_analysis.size(); i++)
+			launch(m_analysis[i].get(), p.analysis, i);
+		for (size_t i = 0; i < m_saver.size(); i++)
+			launch(m_saver[i].get(), p.saver, i);
+		if (!m_stats.empty())
+			launch(m_stats.get(), p.stats);
+	}
+	else {
+		Worker::connect(m_reader.get(), m_stats.get(), &m_summaries);
+		
+		launch(m_reader.get(), p.reader);
+		launch(m_stats.get(), p.stats);
+	}
+}
+
+bool Pipeline::ready() const
+{
+	if (m_cfg->args.statsOnly)
+		return true;
+	std::vector<Worker*> workers = {m_preproc.get()};
+	for (const auto& recon : m_recon)
+		workers.push_back(recon.get());
+	for (const auto& analysis : m_analysis)
+		workers.push_back(analysis.get());
+	for (const auto& saver : m_saver)
+		workers.push_back(saver.get());
+	return std::all_of(workers.begin(), workers.end(), [](Worker* worker) { return worker->ready(); });
+}
+
+void Pipeline::run()
+{
+	// Frames are read only after every stage has warmed up
+	if (m_cfg->args.statsOnly)
+		return;
+	m_log.info("Warm-up done %.2f s after startup", m_startup.time());
+	launch(m_watcher.get(), m_cfg->pipeline.watcher);
+}
+
+void Pipeline::start()
+{
+	launch();
+	while (!ready())
+		msleep(10);
+	run();
+}
+
+void Pipeline::join()
+{
+	for (auto it = m_threads.begin(); it != m_threads.end(); ++it)
+		it->join();
+	m_threads.clear();
+}
@@ -0,0 +1,77 @@
+#ifndef ICEMET_SERVER_PIPELINE_H
+#define ICEMET_SERVER_PIPELINE_H
+
+#include "icemet/worker.hpp"
+#include "icemet/core/config.hpp"
+#include "icemet/core/database.hpp"
+#include "icemet/core/file.hpp"
+#include "icemet/core/pool.hpp"
+#include "icemet/util/log.hpp"
+#include "icemet/util/time.hpp"
+#include "server/analysis.hpp"
+#include "server/checkpointer.hpp"
+#include "server/preproc.hpp"
+#include "server/reader.hpp"
+#include "server/recon.hpp"
+#include "server/saver.hpp"
+#include "server/stats.hpp"
+#include "server/watcher.hpp"
+
+#include <thread>
+#include <vector>
+
+// Workers and queues from the watched files (or the database in stats-only
+// mode) to the saved results and statistics. Replicated stages are
+// connected to every worker of the neighbouring stages. Shards of a batch
+// process a given file list and send their summaries to a shared Stats.
+class Pipeline {
+private:
+	Config* m_cfg;
+	int m_shard;
+	Log m_log;
+	Measure m_startup;
+	ImagePool m_pool; // Workers that may run on any node
+	std::vector<cv::Ptr<ImagePool>> m_nodePools; // Workers pinned to one node
+	
+	cv::Ptr<Watcher> m_watcher;
+	cv::Ptr<Reader> m_reader;
+	cv::Ptr<Preproc> m_preproc;
+	cv::Ptr<Checkpointer> m_checkpointer; // Only with a stack and a state directory
+	std::vector<cv::Ptr<Recon>> m_recon;
+	std::vector<cv::Ptr<Analysis>> m_analysis;
+	std::vector<cv::Ptr<Saver>> m_saver;
+	cv::Ptr<Stats> m_stats;
+	Worker* m_statsWorker;
+	
+	FileQueue m_filesOriginal;
+	FileQueue m_filesPreproc;
+	CheckpointQueue m_checkpoints;
+	FileQueue m_filesRecon;
+	FileQueue m_filesAnalysisSaver;
+	SummaryQueue m_summaries;
+	SummaryQueue* m_statsQueue;
+	
+	std::vector<std::thread> m_threads;
+	
+	static std::vector<int> stageCpus(const StageParam& stage, int replica);
+	ImagePool* pool(const StageParam& stage, int replica=0);
+	void launch(Worker* worker, const StageParam& stage, int replica=0);
+
+public:
+	Pipeline(Config* cfg, Database* db, int shard=0);
+	Pipeline(const Pipeline& pipeline) = delete;
+	Pipeline& operator=(const Pipeline&) = delete;
+	
+	void setFiles(const std::vector<FilePtr>& files, unsigned int seq);
+	void share(Worker* stats, SummaryQueue* summaries);
+	
+	// start() launches the workers, warms them up and then starts reading
+	// frames. Batches run launch() for all shards before run().
+	void launch();
+	bool ready() const;
+	void run();
+	void start();
+	void join();
+};
+
+#endif
@@ -1,38 +1,178 @@
 #include "preproc.hpp"
 
 #include "icemet/core/math.hpp"
+#include "icemet/util/strfmt.hpp"
 #include "icemet/util/time.hpp"
+#include "icemet/util/trace.hpp"
+#include "server/watcher.hpp"
 
+#include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include <cmath>
 #include <exception>
+#include <stdexcept>
 
-Preproc::Preproc(Config* cfg) :
+// Frames compared to the full resolution check per agreement report
+static const int proxyReport = 100;
+
+Preproc::Preproc(Config* cfg, ImagePool* pool) :
 	Worker(COLOR_BRIGHT_GREEN "PREPROC" COLOR_RESET),
-	m_cfg(cfg)
+	m_cfg(cfg),
+	m_pool(pool),
+	m_rotCode(-1),
+	m_checkpoints(NULL),
+	m_proxySeen(0),
+	m_proxyFrames(0),
+	m_proxyAgree(0),
+	m_proxyDiscarded(0) {}
+
+void Preproc::allocate()
 {
 	if (m_cfg->bgsub.enabled) {
 		m_stackLen = m_cfg->bgsub.stackLen;
-		m_stack = cv::icemet::BGSubStack::create(m_cfg->img.size, m_stackLen);
+		if (m_cfg->bgsub.incremental)
+			m_median = cv::makePtr<MedianStack>(m_cfg->img.size, m_stackLen);
+		else
+			m_stack = cv::icemet::BGSubStack::create(m_cfg->img.size, m_stackLen);
 	}
-	if (m_cfg->img.rotation != 0.0) {
-		cv::Point2f center(m_cfg->img.size.width/2.0, m_cfg->img.size.height/2.0);
-		m_rot = cv::getRotationMatrix2D(center, m_cfg->img.rotation, 1.0);
+	
+	// Rotation is applied while cropping. Quarter turns are done with
+	// flips and transposes when they keep the image size, other angles with
+	// a precomputed fixed-point map.
+	const double rotation = m_cfg->img.rotation;
+	if (rotation != 0.0) {
+		const cv::Size2i size = m_cfg->img.size;
+		const double turns = rotation / 90.0;
+		const int quarter = ((int)std::lround(turns) % 4 + 4) % 4;
+		if (turns == std::round(turns) && (quarter % 2 == 0 || size.width == size.height)) {
+			if (quarter == 1)
+				m_rotCode = cv::ROTATE_90_COUNTERCLOCKWISE;
+			else if (quarter == 2)
+				m_rotCode = cv::ROTATE_180;
+			else if (quarter == 3)
+				m_rotCode = cv::ROTATE_90_CLOCKWISE;
+		}
+		else {
+			cv::Point2f center(size.width/2.0, size.height/2.0);
+			cv::Mat rot = cv::getRotationMatrix2D(center, rotation, 1.0);
+			cv::Mat inv;
+			cv::invertAffineTransform(rot, inv);
+			
+			// Coordinates rounded the same way as in warpAffine
+			const int abBits = 10;
+			const int abScale = 1 << abBits;
+			const int roundDelta = abScale / cv::INTER_TAB_SIZE / 2;
+			const double* M = inv.ptr<double>();
+			cv::Mat map1(size, CV_16SC2), map2(size, CV_16UC1);
+			for (int y = 0; y < size.height; y++) {
+				cv::Vec2s* xy = map1.ptr<cv::Vec2s>(y);
+				unsigned short* a = map2.ptr<unsigned short>(y);
+				int X0 = cv::saturate_cast<int>((M[1]*y + M[2])*abScale) + roundDelta;
+				int Y0 = cv::saturate_cast<int>((M[4]*y + M[5])*abScale) + roundDelta;
+				for (int x = 0; x < size.width; x++) {
+					int X = (X0 + cv::saturate_cast<int>(M[0]*x*abScale)) >> (abBits - cv::INTER_BITS);
+					int Y = (Y0 + cv::saturate_cast<int>(M[3]*x*abScale)) >> (abBits - cv::INTER_BITS);
+					xy[x] = cv::Vec2s(cv::saturate_cast<short>(X >> cv::INTER_BITS), cv::saturate_cast<short>(Y >> cv::INTER_BITS));
+					a[x] = (Y & (cv::INTER_TAB_SIZE-1))*cv::INTER_TAB_SIZE + (X & (cv::INTER_TAB_SIZE-1));
+				}
+			}
+			map1.copyTo(m_rotMap1);
+			map2.copyTo(m_rotMap2);
+		}
 	}
+	createHolograms();
+}
+
+void Preproc::createHolograms()
+{
 	m_hologram = cv::icemet::Hologram::create(
 		m_cfg->img.size,
 		m_cfg->hologram.psz, m_cfg->hologram.lambda,
 		m_cfg->hologram.dist
 	);
+	if (m_cfg->proxy.binning > 1) {
+		const int binning = m_cfg->proxy.binning;
+		m_proxy = cv::icemet::Hologram::create(
+			m_cfg->img.size / binning,
+			m_cfg->hologram.psz * binning, m_cfg->hologram.lambda,
+			m_cfg->hologram.dist
+		);
+		m_log.info("Proxy checks binned %dx%d", binning, binning);
+	}
+	else {
+		m_proxy.release();
+	}
+}
+
+void Preproc::reconfigure()
+{
+	const Config* prev = m_cfg;
+	m_cfg = ConfigStore::get();
+	const HologramParam& h0 = prev->hologram;
+	const HologramParam& h1 = m_cfg->hologram;
+	if (h0.psz != h1.psz || h0.lambda != h1.lambda || h0.dist != h1.dist ||
+	    prev->proxy.binning != m_cfg->proxy.binning) {
+		createHolograms();
+		m_log.info("Holograms rebuilt");
+	}
 }
 
 bool Preproc::init()
 {
 	m_filesOriginal = static_cast<FileQueue*>(m_inputs[0]->data);
 	m_filesPreproc = static_cast<FileQueue*>(m_outputs[0]->data);
+	
+	// Outputs are the Recon connections followed by the Checkpointer, which
+	// writes the stack frames for a restart
+	if (m_cfg->bgsub.enabled && !m_cfg->state.dir.empty()) {
+		m_checkpoints = static_cast<CheckpointQueue*>(m_outputs.back()->data);
+		m_stateDir = m_cfg->state.dir / fs::path("bgsub");
+		fs::create_directories(m_stateDir);
+		m_restore = Watcher::list(m_stateDir, m_log);
+	}
 	return true;
 }
 
+void Preproc::warmup()
+{
+	// A uniform frame through the same kernels as process(). The background
+	// subtraction gets a stack of its own.
+	const cv::Size2i size = m_cfg->img.size;
+	const cv::Rect rect = m_cfg->img.rect;
+	cv::UMat original(rect.y+rect.height, rect.x+rect.width, CV_8UC1, cv::Scalar(128));
+	dynRange(original);
+	cv::UMat imgPP = m_pool->getUMat(size, CV_8UC1);
+	cropRotate(original, imgPP);
+	
+	cv::UMat preproc = imgPP;
+	if (m_cfg->bgsub.enabled) {
+		preproc = m_pool->getUMat(size, CV_8UC1);
+		if (m_median) {
+			MedianStack stack(size, m_stackLen);
+			while (!stack.push(imgPP));
+			stack.meddiv(preproc);
+		}
+		else {
+			cv::Ptr<cv::icemet::BGSubStack> stack = cv::icemet::BGSubStack::create(size, m_stackLen);
+			while (!stack->push(imgPP));
+			stack->meddiv(preproc);
+		}
+	}
+	Math::stats(preproc);
+	
+	if (m_cfg->emptyCheck.reconTh > 0 || m_cfg->noisyCheck.contours > 0) {
+		if (m_proxy) {
+			const int binning = m_cfg->proxy.binning;
+			cv::UMat imgBin = m_pool->getUMat(size / binning, CV_8UC1);
+			cv::resize(preproc, imgBin, imgBin.size(), 0, 0, cv::INTER_AREA);
+			check(m_proxy, imgBin, binning, 128, m_cfg->proxy.emptyTh, m_cfg->proxy.contours);
+		}
+		if (!m_proxy || m_cfg->proxy.verify > 0)
+			check(m_hologram, preproc, 1, 128, m_cfg->emptyCheck.reconTh, m_cfg->noisyCheck.contours);
+	}
+}
+
 int Preproc::dynRange(const cv::UMat& img) const
 {
 	double minVal, maxVal;
@@ -40,76 +180,180 @@ int Preproc::dynRange(const cv::UMat& img) const
 	return maxVal - minVal;
 }
 
-void Preproc::finalize(FilePtr file)
+FileStatus Preproc::check(cv::Ptr<cv::icemet::Hologram>& hologram, const cv::UMat& img, int binning, unsigned char bgVal, int emptyTh, int contours)
 {
-	file->param.bgVal =  Math::median(file->preproc);
+	hologram->setImg(img);
+	cv::UMat imgMin = m_pool->getUMat(img.size(), CV_8UC1);
+	cv::icemet::ZRange z = m_cfg->hologram.z;
+	z.step *= 10.0;
+	hologram->min(imgMin, z);
 	
-	if (m_cfg->emptyCheck.reconTh > 0 || m_cfg->noisyCheck.contours > 0) {
-		m_hologram->setImg(file->preproc);
-		cv::UMat imgMin;
-		cv::icemet::ZRange z = m_cfg->hologram.z;
-		z.step *= 10.0;
-		m_hologram->min(imgMin, z);
+	// Empty check
+	if (emptyTh > 0) {
+		double minVal, maxVal;
+		minMaxLoc(imgMin, &minVal, &maxVal);
+		if (maxVal - minVal < emptyTh)
+			return FILE_STATUS_EMPTY;
+	}
+	
+	// Noisy check
+	if (contours > 0) {
+		const cv::Size2i size = img.size();
+		const cv::Size2i border = m_cfg->img.border / binning;
+		const cv::Rect crop(
+			border.width, border.height,
+			size.width-2*border.width, size.height-2*border.height
+		);
+		const int th = m_cfg->segment.thFact * bgVal;
 		
-		// Empty check
-		if (m_cfg->emptyCheck.reconTh > 0) {
-			double minVal, maxVal;
-			minMaxLoc(imgMin, &minVal, &maxVal);
-			if (maxVal - minVal < m_cfg->emptyCheck.reconTh) {
-				file->setStatus(FILE_STATUS_EMPTY);
-				goto end;
-			}
-		}
+		// Threshold
+		cv::UMat imgTh = m_pool->getUMat(crop.size(), CV_8UC1);
+		cv::threshold(cv::UMat(imgMin, crop), imgTh, th, 255, cv::THRESH_BINARY_INV);
 		
-		// Noisy check
-		if (m_cfg->noisyCheck.contours > 0) {
-			const cv::Size2i size = m_cfg->img.size;
-			const cv::Size2i border = m_cfg->img.border;
-			const cv::Rect crop(
-				border.width, border.height,
-				size.width-2*border.width, size.height-2*border.height
-			);
-			const int th = m_cfg->segment.thFact * file->param.bgVal;
-			
-			// Threshold
-			cv::UMat imgTh;
-			cv::threshold(cv::UMat(imgMin, crop), imgTh, th, 255, cv::THRESH_BINARY_INV);
+		// Find contours
+		std::vector<std::vector<cv::Point>> found;
+		std::vector<cv::Vec4i> hierarchy;
+		cv::findContours(
+			imgTh,
+			found, hierarchy,
+			cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE
+		);
+		if ((int)found.size() > contours)
+			return FILE_STATUS_SKIP;
+	}
+	return FILE_STATUS_NONE;
+}
+
+void Preproc::finalize(FilePtr file)
+{
+	TraceSpan span("finalize", file->name());
+	file->param.bgVal = file->param.stats.median;
+	
+	if (m_cfg->emptyCheck.reconTh > 0 || m_cfg->noisyCheck.contours > 0) {
+		FileStatus status;
+		if (m_proxy) {
+			// Check a binned image
+			const int binning = m_cfg->proxy.binning;
+			cv::UMat imgBin = m_pool->getUMat(m_cfg->img.size / binning, CV_8UC1);
+			cv::resize(file->preproc, imgBin, imgBin.size(), 0, 0, cv::INTER_AREA);
+			status = check(m_proxy, imgBin, binning, file->param.bgVal, m_cfg->proxy.emptyTh, m_cfg->proxy.contours);
 			
-			// Find contours
-			std::vector<std::vector<cv::Point>> contours;
-			std::vector<cv::Vec4i> hierarchy;
-			cv::findContours(
-				imgTh,
-				contours, hierarchy,
-				cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE
-			);
-			if ((int)contours.size() > m_cfg->noisyCheck.contours) {
-				file->setStatus(FILE_STATUS_SKIP);
-				goto end;
+			// Compare to the full resolution check on every Nth frame, so
+			// drift is reported during the whole run
+			if (m_cfg->proxy.verify > 0 && m_proxySeen++ % m_cfg->proxy.verify == 0) {
+				FileStatus ref = check(m_hologram, file->preproc, 1, file->param.bgVal, m_cfg->emptyCheck.reconTh, m_cfg->noisyCheck.contours);
+				m_proxyFrames++;
+				if (status == ref) {
+					m_proxyAgree++;
+				}
+				else {
+					m_log.debug("Proxy check %c, full check %c", status, ref);
+					if (ref == FILE_STATUS_NONE)
+						m_proxyDiscarded++;
+				}
+				if (m_proxyFrames == proxyReport) {
+					m_log.info(
+						"Proxy check agreed on %d/%d sampled frames (%d wrongly discarded)",
+						m_proxyAgree, m_proxyFrames, m_proxyDiscarded
+					);
+					m_proxyFrames = 0;
+					m_proxyAgree = 0;
+					m_proxyDiscarded = 0;
+				}
 			}
 		}
+		else {
+			status = check(m_hologram, file->preproc, 1, file->param.bgVal, m_cfg->emptyCheck.reconTh, m_cfg->noisyCheck.contours);
+		}
+		if (status != FILE_STATUS_NONE)
+			file->setStatus(status);
 	}
-end:
 	m_filesPreproc->push(file);
 }
 
+bool Preproc::pushStack(const cv::UMat& img)
+{
+	TraceSpan span("bgsub_push");
+	return m_median ? m_median->push(img) : m_stack->push(img);
+}
+
+void Preproc::restore(const FilePtr& file)
+{
+	// Continue from the frames preceding the first file. The later ones are
+	// read again from the watched directory.
+	std::vector<FilePtr> frames;
+	for (const auto& frame : m_restore) {
+		if (*frame < *file)
+			frames.push_back(frame);
+		else
+			fs::remove(frame->path());
+	}
+	m_restore.clear();
+	
+	int n = 0;
+	size_t first = frames.size() > m_stackLen ? frames.size() - m_stackLen : 0;
+	for (size_t i = 0; i < frames.size(); i++) {
+		m_checkpoints->push({frames[i]->path(), cv::Mat()});
+		if (i < first)
+			continue;
+		cv::Mat img = cv::imread(frames[i]->path().string(), cv::IMREAD_GRAYSCALE);
+		if (img.size() != m_cfg->img.size) {
+			m_log.warning("Invalid stack frame '%s'", frames[i]->path().string().c_str());
+			continue;
+		}
+		cv::UMat imgPP = m_pool->getUMat(m_cfg->img.size, CV_8UC1);
+		img.copyTo(imgPP);
+		pushStack(imgPP);
+		n++;
+	}
+	m_log.info("Restored %d stack frames before %s", n, file->name().c_str());
+}
+
+void Preproc::checkpoint(const FilePtr& file, const cv::UMat& img)
+{
+	// Only the download stays on this thread, the Checkpointer encodes and
+	// writes the frame
+	TraceSpan span("checkpoint");
+	cv::Mat host = m_pool->getMat(img.size(), img.type());
+	img.copyTo(host);
+	m_checkpoints->push({m_stateDir / fs::path(file->name() + ".png"), host});
+}
+
 void Preproc::processBgsub(FilePtr file, cv::UMat& imgPP)
 {
 	// Push to background subtraction stack
-	bool full = m_stack->push(imgPP);
+	if (!m_restore.empty())
+		restore(file);
+	bool full = pushStack(imgPP);
+	if (!m_stateDir.empty())
+		checkpoint(file, imgPP);
 	
 	// Files go through a queue so we maintain the order
 	m_wait.push(file);
 	if (m_wait.size() >= m_stackLen/2 + 1) {
 		FilePtr fileDone = m_wait.front();
 		
+		// Context frames of a shard only fill the stack
+		if (fileDone->param.context) {
+			m_wait.pop();
+			return;
+		}
+		
 		// Perform median division if the background subtraction stack was full
 		if (full) {
-			fileDone->preproc = cv::UMat(m_cfg->img.size, CV_8UC1);
-			m_stack->meddiv(fileDone->preproc);
+			fileDone->preproc = m_pool->getUMat(m_cfg->img.size, CV_8UC1);
+			fileDone->param.preprocessed = true;
+			{
+				TraceSpan span("bgsub_meddiv", fileDone->name());
+				if (m_median)
+					m_median->meddiv(fileDone->preproc);
+				else
+					m_stack->meddiv(fileDone->preproc);
+			}
 			
 			// Check dynamic range
-			if (dynRange(fileDone->preproc) < m_cfg->emptyCheck.preprocTh) {
+			const ImageStats& stats = fileDone->param.stats = Math::stats(fileDone->preproc);
+			if (stats.max - stats.min < m_cfg->emptyCheck.preprocTh) {
 				fileDone->setStatus(FILE_STATUS_EMPTY);
 				m_filesPreproc->push(fileDone);
 			}
@@ -128,7 +372,9 @@ void Preproc::processBgsub(FilePtr file, cv::UMat& imgPP)
 void Preproc::processNoBgsub(FilePtr file, cv::UMat& imgPP)
 {
 	file->preproc = imgPP;
-	if (dynRange(file->preproc) < m_cfg->emptyCheck.preprocTh) {
+	file->param.preprocessed = true;
+	const ImageStats& stats = file->param.stats = Math::stats(file->preproc);
+	if (stats.max - stats.min < m_cfg->emptyCheck.preprocTh) {
 		file->setStatus(FILE_STATUS_EMPTY);
 		m_filesPreproc->push(file);
 	}
@@ -137,21 +383,32 @@ void Preproc::processNoBgsub(FilePtr file, cv::UMat& imgPP)
 	}
 }
 
+void Preproc::cropRotate(const cv::UMat& src, cv::UMat& dst) const
+{
+	// Crop and rotate in one pass
+	TraceSpan span("crop_rotate");
+	const cv::UMat imgCrop(src, m_cfg->img.rect);
+	if (m_rotCode >= 0)
+		cv::rotate(imgCrop, dst, m_rotCode);
+	else if (!m_rotMap1.empty())
+		cv::remap(imgCrop, dst, m_rotMap1, m_rotMap2, cv::INTER_LINEAR);
+	else
+		imgCrop.copyTo(dst);
+}
+
 void Preproc::process(FilePtr file)
 {
 	// Check dynamic range
 	if (dynRange(file->original) < m_cfg->emptyCheck.originalTh) {
+		ImagePool::release(file->original);
 		file->setStatus(FILE_STATUS_EMPTY);
-		m_filesPreproc->push(file);
+		if (!file->param.context)
+			m_filesPreproc->push(file);
 	}
 	else {
-		// Crop and rotate
-		cv::UMat imgCrop, imgPP;
-		cv::UMat(file->original, m_cfg->img.rect).copyTo(imgCrop);
-		if (!m_rot.empty())
-			cv::warpAffine(imgCrop, imgPP, m_rot, imgCrop.size());
-		else
-			imgPP = imgCrop;
+		cv::UMat imgPP = m_pool->getUMat(m_cfg->img.size, CV_8UC1);
+		cropRotate(file->original, imgPP);
+		ImagePool::release(file->original); // Not needed by the later stages
 		
 		if (m_cfg->bgsub.enabled)
 			processBgsub(file, imgPP);
@@ -160,21 +417,42 @@ void Preproc::process(FilePtr file)
 	}
 }
 
+void Preproc::close()
+{
+	// A shard followed by context frames has to get all of its own frames
+	// through. Otherwise the last frames wait for later files, like at the
+	// end of a single pipeline.
+	if (m_wait.empty() || !m_wait.back()->param.context)
+		return;
+	int missing = 0;
+	for (; !m_wait.empty(); m_wait.pop())
+		missing += !m_wait.front()->param.context;
+	if (missing)
+		throw(std::runtime_error(strfmt("%d frames of the shard weren't preprocessed", missing)));
+}
+
 bool Preproc::loop()
 {
 	// Collect files
-	std::queue<FilePtr> files;
-	m_filesOriginal->collect(files);
+	m_filesOriginal->popBatch(m_batch);
 	
 	// Process
-	while (!files.empty()) {
-		FilePtr file = files.front();
+	for (auto& file : m_batch) {
+		if (file->param.shed) {
+			m_filesPreproc->push(std::move(file));
+			continue;
+		}
 		m_log.debug("Processing %s", file->name().c_str());
+		TraceSpan span("preproc", file->name());
 		Measure m;
+		unsigned int allocs = ImagePool::threadAllocs();
 		process(file);
-		m_log.debug("Done %s (%.2f s)", file->name().c_str(), m.time());
-		files.pop();
+		file->param.allocs += ImagePool::threadAllocs() - allocs;
+		double t = m.time();
+		m_metrics.observe(t);
+		m_log.debug("Done %s (%.2f s, %.2f MB)", file->name().c_str(), t, file->memory()/1000000.0);
 	}
+	m_batch.clear();
 	msleep(1);
-	return !m_inputs[0]->closed() || !m_filesOriginal->empty();
+	return !inputsClosed() || !m_filesOriginal->empty();
 }
@@ -2,35 +2,62 @@
 #define ICEMET_SERVER_PREPROC_H
 
 #include "icemet/worker.hpp"
+#include "icemet/core/bgsub.hpp"
 #include "icemet/core/config.hpp"
 #include "icemet/core/file.hpp"
+#include "icemet/core/pool.hpp"
+#include "server/checkpointer.hpp"
 
 #include <opencv2/core.hpp>
 #include <opencv2/icemet.hpp>
 
 #include <queue>
+#include <vector>
 
 class Preproc : public Worker {
 protected:
 	Config* m_cfg;
+	ImagePool* m_pool;
 	FileQueue* m_filesOriginal;
 	FileQueue* m_filesPreproc;
-	cv::Mat m_rot;
+	std::vector<FilePtr> m_batch;
+	int m_rotCode; // cv::RotateFlags for exact rotations, -1 otherwise
+	cv::UMat m_rotMap1;
+	cv::UMat m_rotMap2;
 	size_t m_stackLen;
 	cv::Ptr<cv::icemet::BGSubStack> m_stack;
+	cv::Ptr<MedianStack> m_median;
 	std::queue<FilePtr> m_wait; // Length: m_stackLen/2 + 1
+	fs::path m_stateDir; // Stack frames for a restart, empty if disabled
+	CheckpointQueue* m_checkpoints;
+	std::vector<FilePtr> m_restore; // Stack frames of the previous run
 	cv::Ptr<cv::icemet::Hologram> m_hologram;
+	cv::Ptr<cv::icemet::Hologram> m_proxy;
+	unsigned int m_proxySeen; // Frames checked with the proxy
+	int m_proxyFrames; // Frames also checked at full resolution
+	int m_proxyAgree;
+	int m_proxyDiscarded;
 	
 	int dynRange(const cv::UMat& img) const;
+	void cropRotate(const cv::UMat& src, cv::UMat& dst) const;
+	FileStatus check(cv::Ptr<cv::icemet::Hologram>& hologram, const cv::UMat& img, int binning, unsigned char bgVal, int emptyTh, int contours);
 	void finalize(FilePtr file);
+	bool pushStack(const cv::UMat& img);
+	void restore(const FilePtr& file);
+	void checkpoint(const FilePtr& file, const cv::UMat& img);
 	void processBgsub(FilePtr file, cv::UMat& imgPP);
 	void processNoBgsub(FilePtr file, cv::UMat& imgPP);
 	void process(FilePtr file);
+	void createHolograms();
+	void allocate() override;
+	void warmup() override;
+	void reconfigure() override;
 	bool init() override;
 	bool loop() override;
+	void close() override;
 
 public:
-	Preproc(Config* cfg);
+	Preproc(Config* cfg, ImagePool* pool);
 };
 
 #endif
@@ -7,11 +7,12 @@ Reader::Reader(Config* cfg, Database* db) :
 	m_cfg(cfg),
 	m_db(db),
 	m_id(0),
+	m_seq(0),
 	m_file(NULL) {}
 
 bool Reader::init()
 {
-	m_filesAnalysis = static_cast<FileQueue*>(m_outputs[0]->data);
+	m_summaries = static_cast<SummaryQueue*>(m_outputs[0]->data);
 	return true;
 }
 
@@ -29,7 +30,8 @@ bool Reader::loop()
 		// File complete
 		else if (*tmp != *m_file) {
 			m_log.debug("Read %s", m_file->name().c_str());
-			m_filesAnalysis->push(m_file);
+			m_file->param.seq = m_seq++;
+			m_summaries->push(m_file->summary());
 			m_file = tmp;
 		}
 		
@@ -9,8 +9,9 @@ class Reader : public Worker {
 protected:
 	Config* m_cfg;
 	Database* m_db;
-	FileQueue* m_filesAnalysis;
+	SummaryQueue* m_summaries;
 	unsigned int m_id;
+	unsigned int m_seq;
 	FilePtr m_file;
 	
 	bool init() override;
@@ -0,0 +1,126 @@
+#include "realtime.hpp"
+
+#include "icemet/util/log.hpp"
+#include "icemet/util/time.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <string>
+
+static const char* levelNames[] = {"full", "coarse z-step", "no image saves", "decimated"};
+
+static Log realtimeLog("REALTIME");
+static std::atomic<bool> realtimeEnabled(false);
+static std::atomic<int> realtimeLevel(REALTIME_FULL);
+static std::atomic<int> realtimeDecimation(1);
+static std::mutex realtimeMutex;
+static RealtimeParam realtimeParam;
+static int realtimeWorkers = 1;
+static size_t realtimeBacklog = 0;
+static double realtimeAge = 0.0;
+static double realtimeService = 0.0; // Moving average of the recon time (s)
+static chr::steady_clock::time_point realtimeChanged; // Last mode change
+
+// Frames the reconstruction can keep up with, called with realtimeMutex held
+static int realtimeK()
+{
+	double interval = realtimeService / realtimeWorkers;
+	return std::max(2, (int)std::ceil(interval / realtimeParam.interval));
+}
+
+// Called with realtimeMutex held
+static void realtimeSet(int level)
+{
+	int k = level == REALTIME_DECIMATE ? realtimeK() : 1;
+	int prev = realtimeLevel.exchange(level);
+	realtimeDecimation = k;
+	realtimeChanged = chr::steady_clock::now();
+	
+	std::string mode(levelNames[level]);
+	if (level == REALTIME_DECIMATE)
+		mode += " (1/" + std::to_string(k) + " frames)";
+	realtimeLog.info(
+		"Mode %s -> %s (backlog %zu frames, lag %.1f s, recon %.2f s)",
+		levelNames[prev], mode.c_str(), realtimeBacklog, realtimeAge, realtimeService
+	);
+}
+
+// Called with realtimeMutex held
+static void realtimeUpdate()
+{
+	const RealtimeParam& p = realtimeParam;
+	int level = realtimeLevel;
+	
+	// Follow the reconstruction speed while decimating. The level doesn't
+	// change, so the hold keeps running and recovery isn't postponed.
+	if (level == REALTIME_DECIMATE) {
+		int k = realtimeK();
+		if (k > realtimeDecimation) {
+			realtimeDecimation = k;
+			realtimeLog.info("Decimating 1/%d frames (recon %.2f s)", k, realtimeService);
+		}
+	}
+	
+	if (chr::duration<double>(chr::steady_clock::now() - realtimeChanged).count() < p.hold)
+		return;
+	bool over = (int)realtimeBacklog > p.backlog || realtimeAge > p.lag;
+	bool under = (int)realtimeBacklog <= p.backlog/4 && realtimeAge <= p.lag/4;
+	if (over && level < REALTIME_DECIMATE)
+		realtimeSet(level+1);
+	else if (under && level > REALTIME_FULL)
+		realtimeSet(level-1);
+}
+
+void Realtime::start(const RealtimeParam& param, int workers)
+{
+	std::lock_guard<std::mutex> lock(realtimeMutex);
+	realtimeParam = param;
+	realtimeWorkers = std::max(workers, 1);
+	realtimeBacklog = 0;
+	realtimeAge = 0.0;
+	realtimeService = 0.0;
+	realtimeLevel = REALTIME_FULL;
+	realtimeDecimation = 1;
+	realtimeChanged = chr::steady_clock::now();
+	realtimeEnabled = true;
+	realtimeLog.info(
+		"Target interval %.2f s, backlog %d frames, lag %.1f s",
+		param.interval, param.backlog, param.lag
+	);
+}
+
+bool Realtime::enabled()
+{
+	return realtimeEnabled;
+}
+
+RealtimeLevel Realtime::level()
+{
+	return (RealtimeLevel)realtimeLevel.load();
+}
+
+int Realtime::decimation()
+{
+	return realtimeDecimation;
+}
+
+void Realtime::backlog(size_t frames)
+{
+	if (!realtimeEnabled)
+		return;
+	std::lock_guard<std::mutex> lock(realtimeMutex);
+	realtimeBacklog = frames;
+	realtimeUpdate();
+}
+
+void Realtime::frame(double age, double service)
+{
+	if (!realtimeEnabled)
+		return;
+	std::lock_guard<std::mutex> lock(realtimeMutex);
+	realtimeAge = age;
+	realtimeService = realtimeService > 0.0 ? 0.9*realtimeService + 0.1*service : service;
+	realtimeUpdate();
+}
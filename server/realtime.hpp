@@ -0,0 +1,29 @@
+#ifndef ICEMET_SERVER_REALTIME_H
+#define ICEMET_SERVER_REALTIME_H
+
+#include "icemet/core/config.hpp"
+
+#include <cstddef>
+
+// Load shedding steps, each one includes the previous ones
+typedef enum _realtime_level {
+	REALTIME_FULL = 0, // Everything processed as configured
+	REALTIME_COARSE, // Coarser reconstruction z-step
+	REALTIME_NOSAVE, // No result images, particles are still written
+	REALTIME_DECIMATE // Only every k-th frame processed
+} RealtimeLevel;
+
+// Degrades the processing in steps when the frames arrive faster than they
+// are processed and recovers when the load drops. The Watcher reports the
+// unread frames and Recon the age of every frame it starts.
+class Realtime {
+public:
+	static void start(const RealtimeParam& param, int workers);
+	static bool enabled();
+	static RealtimeLevel level();
+	static int decimation();
+	static void backlog(size_t frames);
+	static void frame(double age, double service);
+};
+
+#endif
@@ -1,25 +1,89 @@
 #include "recon.hpp"
 
 #include "icemet/util/time.hpp"
+#include "icemet/util/trace.hpp"
+#include "server/realtime.hpp"
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 
 #include <algorithm>
-#include <queue>
+#include <cmath>
+#include <utility>
 
-Recon::Recon(Config* cfg) :
+Recon::Recon(Config* cfg, ImagePool* pool) :
 	Worker(COLOR_GREEN "RECON" COLOR_RESET),
-	m_cfg(cfg)
+	m_cfg(cfg),
+	m_pool(pool),
+	m_grid(cfg->img.size)
+{
+	setRange();
+}
+
+void Recon::setRange()
+{
+	// Reconstruct only the planes that can produce counted particles. The
+	// limits stay on the original plane grid.
+	m_z = m_cfg->hologram.z;
+	if (m_cfg->hologram.limitZ) {
+		const cv::icemet::ZRange& z = m_cfg->hologram.z;
+		float start = m_cfg->particle.zMin - m_cfg->hologram.zMargin;
+		float stop = m_cfg->particle.zMax + m_cfg->hologram.zMargin;
+		m_z.start = std::max(z.start, z.start + std::floor((start-z.start)/z.step)*z.step);
+		m_z.stop = std::min(z.stop, z.start + std::ceil((stop-z.start)/z.step)*z.step);
+		m_log.info("Reconstructing %.2f-%.2f mm, skipping %.2f mm of %.2f mm",
+			m_z.start*1e3, m_z.stop*1e3,
+			((m_z.start-z.start) + (z.stop-m_z.stop))*1e3, (z.stop-z.start)*1e3
+		);
+	}
+}
+
+void Recon::allocate()
 {
 	m_hologram = cv::icemet::Hologram::create(
 		m_cfg->img.size,
 		m_cfg->hologram.psz, m_cfg->hologram.lambda,
 		m_cfg->hologram.dist
 	);
+	m_lpf.release();
 	if (m_cfg->lpf.enabled)
 		m_lpf = m_hologram->createLPF(m_cfg->lpf.f);
+	m_focus.release();
+	if (m_cfg->hologram.focusIntegral) {
+		m_focus = cv::makePtr<IntegralFocus>();
+		if (!m_focus->available())
+			m_log.warning("Integral focus requires OpenCL with double precision, using Hologram::focus");
+	}
+}
+
+void Recon::reconfigure()
+{
+	const Config* prev = m_cfg;
+	m_cfg = ConfigStore::get();
+	const HologramParam& h0 = prev->hologram;
+	const HologramParam& h1 = m_cfg->hologram;
+	if (h0.psz != h1.psz || h0.lambda != h1.lambda || h0.dist != h1.dist ||
+	    h0.focusIntegral != h1.focusIntegral ||
+	    prev->lpf.enabled != m_cfg->lpf.enabled || prev->lpf.f != m_cfg->lpf.f) {
+		allocate();
+		m_log.info("Hologram rebuilt");
+	}
+	if (h0.z.start != h1.z.start || h0.z.stop != h1.z.stop || h0.z.step != h1.z.step ||
+	    h0.limitZ != h1.limitZ || h0.zMargin != h1.zMargin ||
+	    prev->particle.zMin != m_cfg->particle.zMin || prev->particle.zMax != m_cfg->particle.zMax)
+		setRange();
+}
+
+void Recon::warmup()
+{
+	// Uniform background with one dark particle
+	cv::Mat img(m_cfg->img.size, CV_8UC1, cv::Scalar(128));
+	cv::circle(img, cv::Point(img.cols/2, img.rows/2), 10, cv::Scalar(30), cv::FILLED);
+	FilePtr file = cv::makePtr<File>();
+	img.copyTo(file->preproc);
+	file->param.bgVal = 128;
+	process(file);
 }
 
 bool Recon::init()
@@ -46,13 +110,30 @@ void Recon::process(FilePtr file)
 	
 	const int th = m_cfg->segment.thFact * file->param.bgVal;
 	
-	cv::icemet::ZRange gz = m_cfg->hologram.z;
+	// Coarser planes when the real-time mode is behind
+	cv::icemet::ZRange lz = m_z;
+	if (Realtime::level() >= REALTIME_COARSE)
+		lz.step *= m_cfg->realtime.zFactor;
+	cv::icemet::ZRange gz = lz;
 	gz.step *= m_cfg->hologram.step;
-	cv::icemet::ZRange lz = m_cfg->hologram.z;
 	
 	int iter = 0;
 	int ncontours = 0;
 	int nsegments = 0;
+	int nfocus = 0;
+	int ncopies = 0;
+	int nskipped = 0;
+	
+	// Segments focused inside their own chunk. A later chunk only sees the
+	// tail of the same particle, so its detection is skipped.
+	const bool merge = m_cfg->segment.merge;
+	std::vector<int> found, candidates;
+	m_grid.clear();
+	
+	std::vector<cv::Rect> rects, rectsStd;
+	std::vector<cv::icemet::FocusMethod> methods;
+	std::vector<int> idxStd;
+	std::vector<double> scoreStd;
 	
 	// Set our image and apply filters
 	m_hologram->setImg(file->preproc);
@@ -61,14 +142,18 @@ void Recon::process(FilePtr file)
 	
 	// Reconstruct whole range in steps
 	for (; gz.start < gz.stop; gz.start += gz.step) {
+		TraceSpan span("recon_chunk");
 		lz.start = gz.start;
 		lz.stop = std::min(lz.start+gz.step, gz.stop);
 		int last = lz.n() - 1;
-		cv::UMat imgMin;
-		m_hologram->reconMin(m_stack, imgMin, lz);
+		cv::UMat imgMin = m_pool->getUMat(size, CV_8UC1);
+		{
+			TraceSpan spanMin("recon_min");
+			m_hologram->reconMin(m_stack, imgMin, lz);
+		}
 		
 		// Threshold
-		cv::UMat imgTh;
+		cv::UMat imgTh = m_pool->getUMat(crop.size(), CV_8UC1);
 		cv::threshold(cv::UMat(imgMin, crop), imgTh, th, 255, cv::THRESH_BINARY_INV);
 		
 		// Find all contours and process them
@@ -83,6 +168,9 @@ void Recon::process(FilePtr file)
 		
 		// Create rects from contours
 		ncontours += contours.size();
+		rects.clear();
+		methods.clear();
+		rectsStd.clear();
 		for (const auto& cnt : contours) {
 			cv::Rect rect = cv::boundingRect(cnt);
 			
@@ -102,10 +190,44 @@ void Recon::process(FilePtr file)
 			rect.width = std::min(rect.width+2*pad, size.width-border.width-rect.x);
 			rect.height = std::min(rect.height+2*pad, size.height-border.height-rect.y);
 			
-			// Focus
+			// Skip particles already focused in an earlier chunk
+			if (merge) {
+				m_grid.query(rect, candidates);
+				if (std::any_of(candidates.begin(), candidates.end(), [&](int i) {
+					return (file->segments[i]->rect & rect).area() > 0;
+				})) {
+					nskipped++;
+					continue;
+				}
+			}
+			
+			rects.push_back(rect);
+			methods.push_back(method);
+			if (method == cv::icemet::FOCUS_STD)
+				rectsStd.push_back(rect);
+		}
+		
+		// Score all std rects together when possible
+		TraceSpan spanFocus("focus");
+		bool integral = m_focus && m_focus->focus(m_stack, 0, last, rectsStd, idxStd, scoreStd);
+		
+		// Focus
+		for (size_t i = 0, j = 0; i < rects.size(); i++) {
+			const cv::Rect& rect = rects[i];
+			const cv::icemet::FocusMethod method = methods[i];
 			int idx = 0;
 			double score = 0.0;
-			cv::icemet::Hologram::focus(m_stack, rect, idx, score, method, 0, last, focusK);
+			if (integral && method == cv::icemet::FOCUS_STD) {
+				idx = idxStd[j];
+				score = scoreStd[j];
+				j++;
+			}
+			else {
+				cv::icemet::Hologram::focus(m_stack, rect, idx, score, method, 0, last, focusK);
+			}
+			nfocus++;
+			if (merge && idx > 0 && idx < last)
+				found.push_back(file->segments.size());
 			
 			// Create segment
 			SegmentPtr segm = cv::makePtr<Segment>();
@@ -115,33 +237,45 @@ void Recon::process(FilePtr file)
 			segm->method = method;
 			segm->rect = rect;
 			cv::UMat(m_stack[idx], rect).copyTo(segm->img);
+			ncopies++;
 			file->segments.push_back(segm);
 		}
+		for (int i : found)
+			m_grid.insert(i, file->segments[i]->rect);
+		found.clear();
 		iter++;
 	}
 	if ((nsegments = file->segments.size()) == 0)
 		file->setStatus(FILE_STATUS_EMPTY);
 	m_log.debug("Segments: %d, Contours: %d", nsegments, ncontours);
+	m_log.debug("Focused: %d, Copied: %d, Skipped: %d", nfocus, ncopies, nskipped);
 }
 
 bool Recon::loop()
 {
 	// Collect files
-	std::queue<FilePtr> files;
-	m_filesPreproc->collect(files);
+	m_filesPreproc->popBatch(m_batch);
 	
 	// Process
-	while (!files.empty()) {
-		FilePtr file = files.front();
+	for (auto& file : m_batch) {
 		if (file->status() == FILE_STATUS_NONE) {
+			TraceSpan span("recon", file->name());
 			Measure m;
 			m_log.debug("Reconstructing %s", file->name().c_str());
+			double age = chr::duration<double>(chr::steady_clock::now() - file->param.found).count();
+			unsigned int allocs = ImagePool::threadAllocs();
 			process(file);
-			m_log.debug("Done %s (%.2f s)", file->name().c_str(), m.time());
+			file->param.allocs += ImagePool::threadAllocs() - allocs;
+			double t = m.time();
+			m_metrics.observe(t);
+			Realtime::frame(age, t);
+			m_log.debug("Done %s (%.2f s, %.2f MB)", file->name().c_str(), t, file->memory()/1000000.0);
 		}
-		m_filesRecon->push(file);
-		files.pop();
+		if (!m_cfg->keeps.preproc)
+			ImagePool::release(file->preproc);
+		m_filesRecon->push(std::move(file));
 	}
+	m_batch.clear();
 	msleep(1);
-	return !m_inputs[0]->closed() || !m_filesPreproc->empty();
+	return !inputsClosed() || !m_filesPreproc->empty();
 }
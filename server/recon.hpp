@@ -4,6 +4,9 @@
 #include "icemet/worker.hpp"
 #include "icemet/core/config.hpp"
 #include "icemet/core/file.hpp"
+#include "icemet/core/focus.hpp"
+#include "icemet/core/grid.hpp"
+#include "icemet/core/pool.hpp"
 
 #include <opencv2/icemet.hpp>
 
@@ -12,18 +15,27 @@
 class Recon : public Worker {
 protected:
 	Config* m_cfg;
+	ImagePool* m_pool;
 	FileQueue* m_filesPreproc;
 	FileQueue* m_filesRecon;
+	std::vector<FilePtr> m_batch;
 	cv::Ptr<cv::icemet::Hologram> m_hologram;
+	cv::icemet::ZRange m_z;
 	std::vector<cv::UMat> m_stack;
 	cv::UMat m_lpf;
+	RectGrid m_grid;
+	cv::Ptr<IntegralFocus> m_focus;
 	
+	void setRange();
 	void process(FilePtr file);
+	void allocate() override;
+	void warmup() override;
+	void reconfigure() override;
 	bool init() override;
 	bool loop() override;
 
 public:
-	Recon(Config* cfg);
+	Recon(Config* cfg, ImagePool* pool);
 };
 
 #endif
@@ -0,0 +1,55 @@
+#include "reloader.hpp"
+
+#include <system_error>
+
+static std::atomic<bool> reloaderHangup(false);
+
+Reloader::Reloader(Config* cfg) :
+	Worker(COLOR_BRIGHT_MAGENTA "RELOADER" COLOR_RESET),
+	m_cfg(cfg),
+	m_stop(false) {}
+
+void Reloader::hangup(int sig)
+{
+	(void)sig;
+	reloaderHangup.store(true);
+}
+
+fs::file_time_type Reloader::mtime() const
+{
+	// An editor may replace the file, so a missing file isn't an error
+	std::error_code ec;
+	fs::file_time_type t = fs::last_write_time(m_cfg->args.cfgFile, ec);
+	return ec ? m_mtime : t;
+}
+
+bool Reloader::init()
+{
+	m_mtime = mtime();
+	m_polled = chr::steady_clock::now();
+	if (m_cfg->reload.watch)
+		m_log.info("Watching %s", m_cfg->args.cfgFile.string().c_str());
+	return true;
+}
+
+bool Reloader::loop()
+{
+	msleep(100);
+	bool reload = reloaderHangup.exchange(false);
+	if (reload)
+		m_log.info("Hangup");
+	
+	// Polled once a second
+	chr::steady_clock::time_point now = chr::steady_clock::now();
+	if (m_cfg->reload.watch && now - m_polled >= chr::seconds(1)) {
+		m_polled = now;
+		fs::file_time_type t = mtime();
+		if (t != m_mtime) {
+			m_mtime = t;
+			reload = true;
+		}
+	}
+	if (reload)
+		ConfigStore::reload();
+	return !m_stop.load();
+}
@@ -0,0 +1,29 @@
+#ifndef ICEMET_SERVER_RELOADER_H
+#define ICEMET_SERVER_RELOADER_H
+
+#include "icemet/worker.hpp"
+#include "icemet/core/config.hpp"
+
+#include <atomic>
+
+// Reloads the configuration file on SIGHUP and, if enabled, when the file
+// is modified.
+class Reloader : public Worker {
+protected:
+	Config* m_cfg;
+	std::atomic<bool> m_stop;
+	chr::steady_clock::time_point m_polled;
+	fs::file_time_type m_mtime;
+	
+	fs::file_time_type mtime() const;
+	bool init() override;
+	bool loop() override;
+
+public:
+	Reloader(Config* cfg);
+	
+	void stop() { m_stop.store(true); }
+	static void hangup(int sig);
+};
+
+#endif
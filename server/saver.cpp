@@ -1,13 +1,19 @@
 #include "saver.hpp"
 
 #include "icemet/util/time.hpp"
+#include "icemet/util/trace.hpp"
+#include "server/realtime.hpp"
+#include "server/stats.hpp"
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/icemet.hpp>
 
-#include <queue>
+#include <atomic>
+#include <vector>
+
+static std::atomic<bool> saverFirst(false);
 
 Saver::Saver(Config* cfg, Database* db) :
 	Worker(COLOR_BRIGHT_BLUE "SAVER" COLOR_RESET),
@@ -17,6 +23,15 @@ Saver::Saver(Config* cfg, Database* db) :
 	m_log.info("Results %s", m_cfg->paths.results.string().c_str());
 }
 
+void Saver::warmup()
+{
+	// Load the encoders
+	cv::Mat img(16, 16, CV_8UC1, cv::Scalar(128));
+	std::vector<unsigned char> buf;
+	cv::imencode("." + m_cfg->types.results.string(), img, buf);
+	cv::imencode("." + m_cfg->types.lossy.string(), img, buf);
+}
+
 bool Saver::init()
 {
 	m_filesAnalysis = static_cast<FileQueue*>(m_inputs[0]->data);
@@ -36,51 +51,100 @@ void Saver::move(const fs::path& src, const fs::path& dst) const
 	}
 }
 
-void Saver::process(const FilePtr& file) const
+void Saver::remove(const FilePtr& file) const
 {
-	if ((file->status() == FILE_STATUS_EMPTY && !m_cfg->saves.empty) ||
-	    (file->status() == FILE_STATUS_SKIP && !m_cfg->saves.skipped) ||
-	    (file->status() == FILE_STATUS_NONE)) {
+	// Originals shared with another shard are removed after the batch
+	if (file->param.shared)
+		file->param.released = true;
+	else
 		fs::remove(file->path());
+}
+
+bool Saver::discard(const FilePtr& file) const
+{
+	return (
+		(file->status() == FILE_STATUS_EMPTY && !m_cfg->saves.empty) ||
+		(file->status() == FILE_STATUS_SKIP && !m_cfg->saves.skipped) ||
+		(file->status() == FILE_STATUS_NONE)
+	);
+}
+
+void Saver::original(const FilePtr& file) const
+{
+	// Originals are kept even when the real-time mode drops the results, so
+	// the frames can be reprocessed later
+	if (!m_cfg->saves.original || discard(file)) {
+		remove(file);
 		return;
 	}
+	fs::create_directories(file->dir(m_cfg->paths.original));
 	
-	int n = file->particles.size();
-	
-	// Save files
-	if (m_cfg->saves.original) {
-		fs::create_directories(file->dir(m_cfg->paths.original));
-		
-		fs::path src(file->path());
-		fs::path dst = file->path(m_cfg->paths.original, src.extension());
-		move(src, dst);
+	fs::path src(file->path());
+	fs::path dst = file->path(m_cfg->paths.original, src.extension());
+	if (file->param.shared) {
+		fs::copy_file(src, dst, fs::copy_options::overwrite_existing);
+		file->param.released = true;
 	}
 	else {
-		fs::remove(file->path());
+		move(src, dst);
 	}
-	if (m_cfg->saves.preproc && !file->preproc.empty()) {
+}
+
+void Saver::releaseOriginals()
+{
+	// With state_dir the original leaves the watched directory only after
+	// Stats has checkpointed the file, so a restart can still count it
+	for (auto it = m_originals.begin(); it != m_originals.end();) {
+		if (m_cfg->state.dir.empty() || Stats::counted((*it)->param.seq)) {
+			original(*it);
+			it = m_originals.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void Saver::write(const fs::path& dst, const cv::Mat& img) const
+{
+	TraceSpan span("imwrite");
+	cv::imwrite(dst.string(), img);
+}
+
+void Saver::process(const FilePtr& file) const
+{
+	if (discard(file))
+		return;
+	
+	int n = file->particles.size();
+	
+	// Save files
+	const bool results = Realtime::level() < REALTIME_NOSAVE;
+	if (results && m_cfg->saves.preproc && !file->preproc.empty()) {
 		fs::create_directories(file->dir(m_cfg->paths.preproc));
 		
 		fs::path dst(file->path(m_cfg->paths.preproc, m_cfg->types.results));
-		cv::imwrite(dst.string(), file->preproc.getMat(cv::ACCESS_READ));
+		write(dst, file->preproc.getMat(cv::ACCESS_READ));
 	}
-	if (m_cfg->saves.recon && file->status() == FILE_STATUS_NOTEMPTY) {
+	if (results && m_cfg->saves.recon && file->status() == FILE_STATUS_NOTEMPTY) {
 		fs::create_directories(file->dir(m_cfg->paths.recon));
 		
 		for (int i = 0; i < n; i++) {
 			fs::path dst(file->path(m_cfg->paths.recon, m_cfg->types.results, i+1));
-			cv::imwrite(dst.string(), file->segments[i]->img);
+			write(dst, file->segments[i]->img);
 		}
 	}
-	if (m_cfg->saves.threshold && file->status() == FILE_STATUS_NOTEMPTY) {
+	if (results && m_cfg->saves.threshold && file->status() == FILE_STATUS_NOTEMPTY) {
 		fs::create_directories(file->dir(m_cfg->paths.threshold));
 		
+		cv::Mat img;
 		for (int i = 0; i < n; i++) {
 			fs::path dst(file->path(m_cfg->paths.threshold, m_cfg->types.results, i+1));
-			cv::imwrite(dst.string(), file->particles[i]->img);
+			file->particles[i]->mask.expand(img);
+			write(dst, img);
 		}
 	}
-	if (m_cfg->saves.preview && file->status() == FILE_STATUS_NOTEMPTY) {
+	if (results && m_cfg->saves.preview && file->status() == FILE_STATUS_NOTEMPTY) {
 		fs::create_directories(file->dir(m_cfg->paths.preview));
 		
 		cv::Mat preview = cv::Mat::zeros(m_cfg->img.size, CV_8UC1);
@@ -98,10 +162,11 @@ void Saver::process(const FilePtr& file) const
 			imgAdj.copyTo(cv::Mat(preview, segm->rect));
 		}
 		fs::path dst(file->path(m_cfg->paths.preview, m_cfg->types.lossy));
-		cv::imwrite(dst.string(), preview);
+		write(dst, preview);
 	}
 	
 	// Write SQL
+	TraceSpan span("sql");
 	for (int i = 0; i < n; i++) {
 		const auto& segm = file->segments[i];
 		const auto& par = file->particles[i];
@@ -119,19 +184,27 @@ void Saver::process(const FilePtr& file) const
 bool Saver::loop()
 {
 	// Collect files
-	std::queue<FilePtr> files;
-	m_filesAnalysis->collect(files);
+	m_filesAnalysis->popBatch(m_batch);
 	
 	// Process
-	while (!files.empty()) {
-		FilePtr file = files.front();
+	for (const auto& file : m_batch) {
 		m_log.debug("Saving %s", file->name().c_str());
+		TraceSpan span("save", file->name());
 		Measure m;
+		size_t mem = file->memory();
 		process(file);
-		m_log.debug("Done %s (%.2f s)", file->name().c_str(), m.time());
+		file->releaseImages(); // Saver is the last user of the images
+		m_originals.push_back(file);
+		double t = m.time();
+		m_metrics.observe(t);
+		m_log.debug("Done %s (%.2f s, %.2f MB)", file->name().c_str(), t, mem/1000000.0);
+		m_log.debug("Allocations: %u", file->param.allocs);
 		m_log.info("Done %s", file->name().c_str());
-		files.pop();
+		if (!saverFirst.exchange(true))
+			m_log.info("First file done %.2f s after startup", m_metrics.uptime());
 	}
+	m_batch.clear();
+	releaseOriginals();
 	msleep(1);
-	return !m_inputs[0]->closed() || !m_filesAnalysis->empty();
+	return !inputsClosed() || !m_filesAnalysis->empty() || !m_originals.empty();
 }
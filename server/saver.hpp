@@ -5,14 +5,25 @@
 #include "icemet/core/config.hpp"
 #include "icemet/core/file.hpp"
 
+#include <deque>
+#include <vector>
+
 class Saver : public Worker {
 protected:
 	Config* m_cfg;
 	Database* m_db;
 	FileQueue* m_filesAnalysis;
+	std::vector<FilePtr> m_batch;
+	std::deque<FilePtr> m_originals; // Waiting for Stats to checkpoint them
 	
 	void move(const fs::path& src, const fs::path& dst) const;
+	void remove(const FilePtr& file) const;
+	bool discard(const FilePtr& file) const;
+	void original(const FilePtr& file) const;
+	void releaseOriginals();
+	void write(const fs::path& dst, const cv::Mat& img) const;
 	void process(const FilePtr& file) const;
+	void warmup() override;
 	bool init() override;
 	bool loop() override;
 
@@ -3,17 +3,37 @@
 #include "icemet/core/math.hpp"
 #include "icemet/util/strfmt.hpp"
 #include "icemet/util/time.hpp"
+#include "icemet/util/trace.hpp"
 
 #include <opencv2/core.hpp>
 #include <opencv2/icemet.hpp>
 
-#include <queue>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <vector>
 #include <stdexcept>
+#include <string>
+#include <utility>
+
+// Files before this sequence number have been counted
+static std::atomic<unsigned int> statsCounted(0);
 
 Stats::Stats(Config* cfg, Database* db) :
 	Worker(COLOR_BLUE "STATS" COLOR_RESET),
 	m_cfg(cfg),
-	m_db(db)
+	m_db(db),
+	m_nextCfg(NULL),
+	m_next(0)
+{
+	setVolume();
+	m_len = m_cfg->stats.time * 1000;
+	
+	reset();
+}
+
+void Stats::setVolume()
 {
 	int wpx = m_cfg->img.size.width - 2*m_cfg->img.border.width;
 	int hpx = m_cfg->img.size.height - 2*m_cfg->img.border.height;
@@ -30,32 +50,160 @@ Stats::Stats(Config* cfg, Database* db) :
 	double AZ1 = Apx * pszZ1*pszZ1;
 	m_V = Math::Vcone(h, AZ0, AZ1);
 	m_log.debug("Measurement volume %.2f cm3", m_V * 1000000);
-	
-	m_len = m_cfg->stats.time * 1000;
-	
-	reset();
+}
+
+void Stats::warmup()
+{
+	// Histogram of a few particles
+	cv::Mat diams(4, 1, CV_64F, cv::Scalar(m_cfg->particle.diamMin));
+	cv::Mat counts, bins;
+	cv::icemet::hist(
+		diams.getUMat(cv::ACCESS_READ),
+		counts, bins,
+		m_cfg->particle.diamMin, m_cfg->particle.diamMax, m_cfg->particle.diamStep
+	);
+}
+
+void Stats::reconfigure()
+{
+	// The particle limits also define the measurement volume, so the whole
+	// window is counted and normalized with the same config
+	m_nextCfg = ConfigStore::get();
 }
 
 bool Stats::init()
 {
 	if (m_cfg->args.statsOnly && m_cfg->stats.frames <= 0)
 		throw(std::runtime_error("stats_frames required in stats only mode"));
-	m_filesAnalysis = static_cast<FileQueue*>(m_inputs[0]->data);
+	m_summaries = static_cast<SummaryQueue*>(m_inputs[0]->data);
+	
+	// Stats only mode reads everything from the database again
+	if (!m_cfg->state.dir.empty() && !m_cfg->args.statsOnly) {
+		fs::create_directories(m_cfg->state.dir);
+		m_state = m_cfg->state.dir / fs::path("stats.yml");
+		if (fs::exists(m_state))
+			load();
+		save();
+	}
 	return true;
 }
 
+bool Stats::counted(unsigned int seq)
+{
+	return seq < statsCounted;
+}
+
+void Stats::load()
+{
+	cv::FileStorage storage(m_state.string(), cv::FileStorage::READ);
+	if (!storage.isOpened())
+		throw(std::runtime_error("Couldn't read " + m_state.string()));
+	m_dt.setStamp(std::stoull((std::string)storage["stamp"]));
+	m_frames = (int)storage["frames"];
+	m_shed = (int)storage["shed"];
+	storage["particles"] >> m_particles;
+	if (m_particles.empty())
+		m_particles = cv::Mat(0, 0, CV_64F);
+	std::string last = (std::string)storage["last"];
+	if (!last.empty()) {
+		m_last = cv::makePtr<File>();
+		m_last->setName(last);
+	}
+	
+	// Replay the files counted after the snapshot. Files up to its last one
+	// are already included if the journal wasn't truncated before a crash.
+	fs::path journalPath(m_state);
+	journalPath.replace_filename("stats.log");
+	std::ifstream journal(journalPath);
+	std::string line;
+	while (std::getline(journal, line)) {
+		// The last line is incomplete if writing it was interrupted
+		if (journal.eof())
+			break;
+		std::istringstream ss(line);
+		std::string name;
+		bool frame, shed;
+		ss >> name >> frame >> shed;
+		FilePtr file = cv::makePtr<File>();
+		file->setName(name);
+		if (!m_last.empty() && *file <= *m_last)
+			continue;
+		m_frames += frame;
+		m_shed += shed;
+		double diam;
+		while (ss >> diam)
+			m_particles.push_back(diam);
+		m_last = file;
+	}
+	m_log.info(
+		"Restored %u frames and %d particles after %s",
+		m_frames, m_particles.rows, m_last.empty() ? "" : m_last->name().c_str()
+	);
+}
+
+void Stats::save()
+{
+	// Replaced in one step so a crash leaves the previous state
+	fs::path tmp(m_state);
+	tmp.replace_filename("stats.tmp.yml");
+	{
+		cv::FileStorage storage(tmp.string(), cv::FileStorage::WRITE);
+		storage << "stamp" << std::to_string(m_dt.stamp());
+		storage << "frames" << (int)m_frames;
+		storage << "shed" << (int)m_shed;
+		storage << "particles" << m_particles;
+		storage << "last" << (m_last.empty() ? std::string() : m_last->name());
+	}
+	fs::rename(tmp, m_state);
+	
+	// The journal starts over from the snapshot
+	fs::path journalPath(m_state);
+	journalPath.replace_filename("stats.log");
+	m_journal.close();
+	m_journal.open(journalPath, std::ios::trunc);
+	if (!m_journal.is_open())
+		throw(std::runtime_error("Couldn't write " + journalPath.string()));
+	m_journal.precision(std::numeric_limits<double>::max_digits10);
+}
+
+void Stats::record(const std::string& name, bool frame, bool shed, int first)
+{
+	// One line per file with the diameters it added, flushed before the
+	// Saver may remove the original
+	m_journal << name << ' ' << frame << ' ' << shed;
+	for (int i = first; i < m_particles.rows; i++)
+		m_journal << ' ' << m_particles.at<double>(i);
+	m_journal << std::endl;
+	if (!m_journal)
+		throw(std::runtime_error("Couldn't write the stats journal"));
+}
+
 void Stats::reset(const DateTime& dt)
 {
+	if (m_nextCfg) {
+		m_cfg = m_nextCfg;
+		m_nextCfg = NULL;
+		setVolume();
+	}
+	
 	m_particles = cv::Mat(0, 0, CV_64F);
 	m_frames = 0;
+	m_shed = 0;
 	
 	m_dt.setStamp(dt.stamp() / m_len * m_len);
+	
+	// Windows are checkpointed as they start, later files go to the journal
+	if (!m_state.empty())
+		save();
 }
 
 void Stats::fillStatsRow(StatsRow& row) const
 {
-	// Use fixed frames?
-	unsigned int frames = m_cfg->stats.frames > 0 ? m_cfg->stats.frames : m_frames;
+	// Use fixed frames? The share of frames shed in real-time mode wasn't
+	// measured.
+	unsigned int frames = m_frames;
+	if (m_cfg->stats.frames > 0)
+		frames = m_shed ? std::lround((double)m_cfg->stats.frames * m_frames / (m_frames + m_shed)) : m_cfg->stats.frames;
 	
 	unsigned int particles = m_particles.rows;
 	if (!particles) {
@@ -119,6 +267,7 @@ void Stats::statsPoint() const
 {
 	StatsRow row;
 	fillStatsRow(row);
+	TraceSpan span("sql");
 	m_db->writeStats(row);
 	m_log.info(
 		"[%02d:%02d:%02d] LWC %.2f g/m3, MVD %.2f um, Conc %.2f #/cm3",
@@ -127,24 +276,22 @@ void Stats::statsPoint() const
 	);
 }
 
-bool Stats::particleValid(const ParticlePtr& par) const
+bool Stats::particleValid(const ParticleSummary& par) const
 {
 	return (
-		par->z >= m_cfg->particle.zMin &&
-		par->z <= m_cfg->particle.zMax &&
-		par->diam >= m_cfg->particle.diamMin &&
-		par->diam <= m_cfg->particle.diamMax &&
-		par->circularity >= m_cfg->particle.circMin &&
-		par->circularity <= m_cfg->particle.circMax &&
-		par->dynRange >= m_cfg->particle.dynRangeMin &&
-		par->dynRange <= m_cfg->particle.dynRangeMax
+		par.z >= m_cfg->particle.zMin &&
+		par.z <= m_cfg->particle.zMax &&
+		par.diam >= m_cfg->particle.diamMin &&
+		par.diam <= m_cfg->particle.diamMax &&
+		par.circularity >= m_cfg->particle.circMin &&
+		par.circularity <= m_cfg->particle.circMax &&
+		par.dynRange >= m_cfg->particle.dynRangeMin &&
+		par.dynRange <= m_cfg->particle.dynRangeMax
 	);
 }
 
-void Stats::process(const FilePtr& file)
+void Stats::advance(const DateTime& dt)
 {
-	DateTime dt = file->dt();
-	
 	// Make sure we have datetime
 	if (m_dt.stamp() == 0)
 		reset(dt);
@@ -154,12 +301,15 @@ void Stats::process(const FilePtr& file)
 		statsPoint();
 		reset(dt);
 	}
-	
+}
+
+void Stats::process(const FileSummary& summary)
+{
 	// Get particle diameters
 	int count = 0;
-	for (const auto& par : file->particles) {
+	for (const auto& par : summary.particles) {
 		if (particleValid(par)) {
-			m_particles.push_back(par->diam);
+			m_particles.push_back(par.diam);
 			count++;
 		}
 	}
@@ -167,36 +317,78 @@ void Stats::process(const FilePtr& file)
 	m_log.debug("Valid particles: %d", count);
 }
 
+void Stats::receive(const FileSummary& summary)
+{
+	m_log.debug("Analysing %s", summary.name.c_str());
+	TraceSpan span("stats", summary.name);
+	Measure m;
+	
+	// Files counted before a restart are processed again if the Saver
+	// hadn't finished them
+	FilePtr file;
+	if (!m_state.empty()) {
+		file = cv::makePtr<File>();
+		file->setName(summary.name);
+		if (!m_last.empty() && *file <= *m_last) {
+			m_log.debug("Already counted %s", summary.name.c_str());
+			return;
+		}
+	}
+	
+	// Skip files that haven't been preprocessed (the first few files)
+	const bool frame = !summary.shed && summary.status != FILE_STATUS_SKIP && (m_cfg->args.statsOnly || summary.preprocessed);
+	if (summary.shed || frame)
+		advance(summary.dt);
+	int first = m_particles.rows;
+	if (summary.shed)
+		m_shed++;
+	else if (frame)
+		process(summary);
+	if (!m_state.empty()) {
+		m_last = file;
+		record(summary.name, frame, summary.shed, first);
+	}
+	double t = m.time();
+	m_metrics.observe(t);
+	m_log.debug("Done %s (%.2f s)", summary.name.c_str(), t);
+}
+
 bool Stats::loop()
 {
-	// Collect files
-	std::queue<FilePtr> files;
-	m_filesAnalysis->collect(files);
+	// Collect files. Replicated stages may reorder them, so they are
+	// processed in input order.
+	m_summaries->popBatch(m_batch);
+	for (auto& summary : m_batch)
+		m_pending.emplace(summary.seq, std::move(summary));
+	m_batch.clear();
 	
 	// Process
-	while (!files.empty()) {
-		FilePtr file = files.front();
-		m_log.debug("Analysing %s", file->name().c_str());
-		Measure m;
-		
-		// Skip files that haven't been preprocessed (the first few files)
-		if (file->status() != FILE_STATUS_SKIP)
-		
-		if (m_cfg->args.statsOnly || !file->preproc.empty())
-			process(file);
-		m_log.debug("Done %s (%.2f s)", file->name().c_str(), m.time());
-		files.pop();
+	for (auto it = m_pending.begin(); it != m_pending.end() && it->first == m_next; it = m_pending.erase(it)) {
+		receive(it->second);
+		m_next++;
 	}
+	statsCounted = m_next;
 	
 	if (m_inputs.empty()) {
 		return false;
 	}
 	msleep(1);
-	return !m_inputs[0]->closed() || !m_filesAnalysis->empty();
+	return !inputsClosed() || !m_summaries->empty();
 }
 
 void Stats::close()
 {
+	// Summaries left waiting mean an earlier file never arrived
+	if (!m_pending.empty())
+		m_log.warning("Frame %u never arrived, %zu later frames counted out of order", m_next, m_pending.size());
+	for (const auto& it : m_pending)
+		receive(it.second);
+	m_pending.clear();
 	if (m_frames)
 		statsPoint();
+	
+	// The next run starts a new window
+	if (!m_state.empty())
+		reset();
+	statsCounted = std::numeric_limits<unsigned int>::max();
 }
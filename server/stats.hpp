@@ -6,28 +6,52 @@
 #include "icemet/core/file.hpp"
 #include "icemet/util/time.hpp"
 
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
 class Stats : public Worker {
 protected:
 	Config* m_cfg;
 	Database* m_db;
-	FileQueue* m_filesAnalysis;
+	Config* m_nextCfg; // Reloaded config, applied when the next window starts
+	SummaryQueue* m_summaries;
+	std::vector<FileSummary> m_batch;
+	std::map<unsigned int, FileSummary> m_pending; // Waiting for earlier files
+	unsigned int m_next;
 	double m_V;
 	DateTime m_dt;
 	Timestamp m_len;
 	cv::Mat m_particles;
 	unsigned int m_frames;
+	unsigned int m_shed; // Frames dropped by the real-time mode
+	fs::path m_state; // Window snapshot for a restart, empty if disabled
+	std::ofstream m_journal; // Files counted after the snapshot
+	FilePtr m_last; // Last file counted in the window
 	
+	void setVolume();
 	void reset(const DateTime& dt=DateTime());
+	void advance(const DateTime& dt);
+	void load();
+	void save();
+	void record(const std::string& name, bool frame, bool shed, int first);
 	void fillStatsRow(StatsRow& row) const;
 	void statsPoint() const;
-	bool particleValid(const ParticlePtr& par) const;
-	void process(const FilePtr& file);
+	bool particleValid(const ParticleSummary& par) const;
+	void process(const FileSummary& summary);
+	void receive(const FileSummary& summary);
+	void warmup() override;
+	void reconfigure() override;
 	bool init() override;
 	bool loop() override;
 	void close() override;
 
 public:
 	Stats(Config* cfg, Database* db);
+	
+	// True once the file is counted and, with state_dir, checkpointed
+	static bool counted(unsigned int seq);
 };
 
 #endif
@@ -1,17 +1,25 @@
 #include "watcher.hpp"
 
 #include "icemet/util/time.hpp"
+#include "icemet/util/trace.hpp"
+#include "server/realtime.hpp"
 
 #include <opencv2/imgcodecs.hpp>
 
 #include <algorithm>
+#include <fstream>
+#include <iterator>
 #include <stdexcept>
 #include <vector>
 
-Watcher::Watcher(Config* cfg) :
+Watcher::Watcher(Config* cfg, ImagePool* pool) :
 	Worker(COLOR_BRIGHT_CYAN "WATCHER" COLOR_RESET),
 	m_cfg(cfg),
-	m_prev(cv::makePtr<File>())
+	m_pool(pool),
+	m_prev(cv::makePtr<File>()),
+	m_seq(0),
+	m_list(false),
+	m_size(m_cfg->img.rect.x + m_cfg->img.rect.width, m_cfg->img.rect.y + m_cfg->img.rect.height)
 {
 	m_log.info("Watching %s", m_cfg->paths.watch.string().c_str());
 }
@@ -22,11 +30,18 @@ bool Watcher::init()
 	return true;
 }
 
-void Watcher::findFiles(std::queue<cv::Ptr<File>>& files)
+void Watcher::setFiles(const std::vector<FilePtr>& files, unsigned int seq)
+{
+	m_list = true;
+	m_files = files;
+	m_seq = seq;
+}
+
+std::vector<FilePtr> Watcher::list(const fs::path& dir, const Log& log)
 {
 	// Find files
 	std::vector<cv::Ptr<File>> filesVec;
-	auto iter = fs::recursive_directory_iterator(m_cfg->paths.watch);
+	auto iter = fs::recursive_directory_iterator(dir);
 	for (const auto& entry : iter) {
 		if (!entry.is_regular_file())
 			continue;
@@ -37,7 +52,7 @@ void Watcher::findFiles(std::queue<cv::Ptr<File>>& files)
 			filesVec.push_back(cv::makePtr<File>(path));
 		}
 		catch (std::exception& e) {
-			m_log.debug("Ignoring: '%s'", path.string().c_str());
+			log.debug("Ignoring: '%s'", path.string().c_str());
 		}
 	}
 	
@@ -45,10 +60,45 @@ void Watcher::findFiles(std::queue<cv::Ptr<File>>& files)
 	std::sort(filesVec.begin(), filesVec.end(), [](const auto& f1, const auto& f2) {
 		return *f1 < *f2;
 	});
+	return filesVec;
+}
+
+void Watcher::findFiles(std::queue<cv::Ptr<File>>& files)
+{
+	std::vector<cv::Ptr<File>> filesVec;
+	if (m_list)
+		filesVec.swap(m_files);
+	else
+		filesVec = list(m_cfg->paths.watch, m_log);
 	
 	// Push to queue
-	for (const auto& file : filesVec)
+	chr::steady_clock::time_point now = chr::steady_clock::now();
+	for (const auto& file : filesVec) {
+		file->param.found = now;
 		files.push(file);
+	}
+}
+
+bool Watcher::readImage(const fs::path& path, cv::UMat& dst)
+{
+	// Read the file to a reused buffer
+	std::ifstream stream(path, std::ios::binary);
+	if (!stream)
+		return false;
+	m_buf.clear();
+	m_buf.insert(m_buf.end(), std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	
+	// Decode to a pooled image. The frame size is taken from the previous
+	// frame and imdecode reallocates if it doesn't match.
+	TraceSpan span("decode");
+	cv::Mat mat = m_pool->getMat(m_size, CV_8UC1);
+	if (!cv::imdecode(m_buf, cv::IMREAD_GRAYSCALE, &mat).data)
+		return false;
+	m_size = mat.size();
+	
+	dst = m_pool->getUMat(m_size, CV_8UC1);
+	mat.copyTo(dst);
+	return true;
 }
 
 bool Watcher::loop()
@@ -60,20 +110,40 @@ bool Watcher::loop()
 		
 		// Check if the file is new
 		if (*file > *m_prev) {
+			Realtime::backlog(files.size());
+			
+			// Pass the file on unread when the real-time mode is decimating
+			if (Realtime::level() >= REALTIME_DECIMATE && m_seq % Realtime::decimation()) {
+				file->param.shed = true;
+				file->setStatus(FILE_STATUS_SKIP);
+				file->param.seq = m_seq++;
+				m_log.debug("Shed %s", file->name().c_str());
+				m_filesOriginal->push(file);
+				m_prev = file;
+				files.pop();
+				continue;
+			}
+			
+			TraceSpan span("read", file->name());
 			Measure m;
 			
 			// Open the image
 			std::string fn(file->path().string());
-			cv::Mat mat = cv::imread(fn, cv::IMREAD_GRAYSCALE);
-			if (!mat.data) {
+			unsigned int allocs = ImagePool::threadAllocs();
+			if (!readImage(file->path(), file->original)) {
 				m_log.debug("Invalid image file: '%s'", fn.c_str());
 				break;
 			}
-			mat.getUMat(cv::ACCESS_READ).copyTo(file->original);
+			file->param.allocs += ImagePool::threadAllocs() - allocs;
 			
-			// Push to output queue
+			// Push to output queue. Context frames are dropped by Preproc and
+			// don't take a place in the order.
 			file->setStatus(FILE_STATUS_NONE);
-			m_log.debug("Opened %s (%.2f s)", file->name().c_str(), m.time());
+			if (!file->param.context)
+				file->param.seq = m_seq++;
+			double t = m.time();
+			m_metrics.observe(t);
+			m_log.debug("Opened %s (%.2f s)", file->name().c_str(), t);
 			m_filesOriginal->push(file);
 			m_prev = file;
 		}
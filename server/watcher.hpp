@@ -4,21 +4,35 @@
 #include "icemet/worker.hpp"
 #include "icemet/core/config.hpp"
 #include "icemet/core/file.hpp"
+#include "icemet/core/pool.hpp"
+#include "icemet/util/log.hpp"
 
 #include <queue>
+#include <vector>
 
 class Watcher : public Worker {
 protected:
 	Config* m_cfg;
+	ImagePool* m_pool;
 	FileQueue* m_filesOriginal;
 	FilePtr m_prev;
+	unsigned int m_seq;
+	bool m_list; // Process m_files instead of watching
+	std::vector<FilePtr> m_files;
+	cv::Size2i m_size;
+	std::vector<unsigned char> m_buf;
+	
+	bool readImage(const fs::path& path, cv::UMat& dst);
 	
 	void findFiles(std::queue<FilePtr>& files);
 	bool init() override;
 	bool loop() override;
 
 public:
-	Watcher(Config* cfg);
+	Watcher(Config* cfg, ImagePool* pool);
+	
+	void setFiles(const std::vector<FilePtr>& files, unsigned int seq);
+	static std::vector<FilePtr> list(const fs::path& dir, const Log& log);
 };
 
 #endif
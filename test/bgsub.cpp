@@ -0,0 +1,101 @@
+#include "icemet/core/bgsub.hpp"
+#include "test/test.hpp"
+
+#include <opencv2/core.hpp>
+#include <opencv2/icemet.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+// Sizes with and without a partial row tile
+static const cv::Size2i sizes[] = {{97, 61}, {256, 128}};
+static const int lens[] = {2, 3, 5, 8, 9, 16};
+
+// Noisy background with dark particles. Repeated frames, a dark corner and
+// scattered 0 and 255 pixels give ties, zero medians and saturation.
+static void randomFrame(cv::RNG& rng, cv::Mat& frame, bool repeat)
+{
+	if (repeat && rng.uniform(0, 5) == 0)
+		return;
+	const cv::Size2i size = frame.size();
+	cv::Mat noise(size, CV_32FC1);
+	rng.fill(noise, cv::RNG::NORMAL, cv::Scalar(rng.uniform(60, 200)), cv::Scalar(rng.uniform(1, 30)));
+	noise.convertTo(frame, CV_8UC1);
+	for (int i = rng.uniform(0, 8); i > 0; i--) {
+		cv::Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+		cv::circle(frame, center, rng.uniform(1, 10), cv::Scalar(rng.uniform(0, 40)), -1);
+	}
+	if (rng.uniform(0, 2))
+		frame(cv::Rect(0, 0, size.width/4, size.height/4)).setTo(0);
+	for (int i = 0; i < 20; i++)
+		frame.at<unsigned char>(rng.uniform(0, size.height), rng.uniform(0, size.width)) = rng.uniform(0, 2) ? 255 : 0;
+}
+
+TEST(bgsub_median)
+{
+	cv::RNG rng(0xb65b);
+	for (const auto& size : sizes) {
+		for (int len : lens) {
+			MedianStack stack(size, len);
+			std::deque<cv::Mat> window;
+			cv::Mat frame(size, CV_8UC1);
+			for (int i = 0; i < 3*len; i++) {
+				randomFrame(rng, frame, i > 0);
+				window.push_back(frame.clone());
+				if ((int)window.size() > len)
+					window.pop_front();
+				bool full = stack.push(frame.getUMat(cv::ACCESS_READ));
+				CHECKF(full == ((int)window.size() == len), "len %d, frame %d", len, i);
+				if (!full)
+					continue;
+				
+				// Rank len/2 of every pixel
+				cv::Mat med;
+				stack.median(med);
+				std::vector<unsigned char> vals(len);
+				for (int y = 0; y < size.height; y++) {
+					for (int x = 0; x < size.width; x++) {
+						for (int k = 0; k < len; k++)
+							vals[k] = window[k].at<unsigned char>(y, x);
+						std::nth_element(vals.begin(), vals.begin() + len/2, vals.end());
+						CHECKF(
+							med.at<unsigned char>(y, x) == vals[len/2],
+							"len %d, frame %d, pixel (%d, %d)", len, i, x, y
+						);
+					}
+				}
+			}
+		}
+	}
+}
+
+TEST(bgsub_meddiv)
+{
+	// MedianStack replaces BGSubStack, so its output must match exactly
+	cv::RNG rng(0xd1f);
+	for (const auto& size : sizes) {
+		for (int len : lens) {
+			MedianStack stack(size, len);
+			cv::Ptr<cv::icemet::BGSubStack> ref = cv::icemet::BGSubStack::create(size, len);
+			cv::Mat frame(size, CV_8UC1);
+			for (int i = 0; i < 3*len; i++) {
+				randomFrame(rng, frame, i > 0);
+				cv::UMat img = frame.getUMat(cv::ACCESS_READ);
+				bool full = stack.push(img);
+				bool refFull = ref->push(img);
+				CHECKF(full == refFull, "len %d, frame %d", len, i);
+				if (!full)
+					continue;
+				
+				cv::UMat dst, refDst;
+				stack.meddiv(dst);
+				ref->meddiv(refDst);
+				CHECKF(dst.size() == refDst.size() && dst.type() == refDst.type(), "len %d, frame %d", len, i);
+				double diff = cv::norm(dst, refDst, cv::NORM_INF);
+				CHECKF(diff == 0.0, "len %d, frame %d, differs by %.0f", len, i, diff);
+			}
+		}
+	}
+}
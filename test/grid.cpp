@@ -0,0 +1,171 @@
+#include "icemet/core/config.hpp"
+#include "icemet/core/file.hpp"
+#include "icemet/core/grid.hpp"
+#include "icemet/core/pool.hpp"
+#include "server/analysis.hpp"
+#include "test/test.hpp"
+
+#include <opencv2/core.hpp>
+#include <opencv2/icemet.hpp>
+
+#include <algorithm>
+#include <vector>
+
+// Local to this file, the other tests expose other members
+namespace {
+
+class AnalysisProbe : public Analysis {
+public:
+	using Analysis::Analysis;
+	using Analysis::unique;
+};
+
+}
+
+// Frame size that isn't a multiple of the cell size
+static const cv::Size2i size(650, 470);
+
+// Overlap resolution as it was before the grid: every segment is compared
+// to every unique segment and replaces the first overlapping one if it is
+// better
+static void uniqueReference(const std::vector<SegmentPtr>& segments, const std::vector<ParticlePtr>& particles, std::vector<SegmentPtr>& segmentsUnique, std::vector<ParticlePtr>& particlesUnique)
+{
+	int ni = segments.size();
+	for (int i = 0; i < ni; i++) {
+		const auto& segm = segments[i];
+		const auto& par = particles[i];
+		
+		bool found = false;
+		int nj = segmentsUnique.size();
+		for (int j = 0; j < nj; j++) {
+			const auto& segmOld = segmentsUnique[j];
+			const auto& parOld = particlesUnique[j];
+			
+			if ((segm->rect & segmOld->rect).area() > 0) {
+				if ((segm->iter == segmOld->iter && segm->rect.area() > segmOld->rect.area()) ||
+				    (segm->iter != segmOld->iter && (
+						(segm->method == segmOld->method && segm->score > segmOld->score) ||
+						(segm->method != segmOld->method && par->dynRange > parOld->dynRange)
+					))) {
+					segmentsUnique[j] = segm;
+					particlesUnique[j] = par;
+				}
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			segmentsUnique.push_back(segm);
+			particlesUnique.push_back(par);
+		}
+	}
+}
+
+// Rects anywhere in the frame, touching its edges or packed into a small
+// area. The properties are drawn from a few values so ties are common.
+static cv::Rect randomRect(cv::RNG& rng, bool dense)
+{
+	static const int sides[] = {1, 8, 16, 63, 64, 65, 130};
+	int w = sides[rng.uniform(0, 7)];
+	int h = rng.uniform(0, 2) ? w : sides[rng.uniform(0, 7)];
+	const cv::Rect area = dense ? cv::Rect(200, 150, 160, 120) : cv::Rect(0, 0, size.width, size.height);
+	int x = area.x + rng.uniform(0, std::max(1, area.width - w + 1));
+	int y = area.y + rng.uniform(0, std::max(1, area.height - h + 1));
+	if (!rng.uniform(0, 10))
+		x = rng.uniform(0, 2) ? 0 : size.width - w;
+	if (!rng.uniform(0, 10))
+		y = rng.uniform(0, 2) ? 0 : size.height - h;
+	return cv::Rect(x, y, w, h);
+}
+
+static void randomSegments(cv::RNG& rng, int n, bool dense, std::vector<SegmentPtr>& segments, std::vector<ParticlePtr>& particles)
+{
+	static const cv::icemet::FocusMethod methods[] = {cv::icemet::FOCUS_STD, cv::icemet::FOCUS_MIN};
+	static const double scores[] = {0.0, 0.5, 1.0};
+	segments.clear();
+	particles.clear();
+	for (int i = 0; i < n; i++) {
+		SegmentPtr segm = cv::makePtr<Segment>();
+		segm->rect = randomRect(rng, dense);
+		segm->iter = rng.uniform(0, 3);
+		segm->method = methods[rng.uniform(0, 2)];
+		segm->score = scores[rng.uniform(0, 3)];
+		segments.push_back(segm);
+	}
+	
+	// Analysis sorts the segments by area before measuring them. Ties stay
+	// in random order.
+	std::stable_sort(segments.begin(), segments.end(), [](const auto& s1, const auto& s2) {
+		return s1->rect.area() > s2->rect.area();
+	});
+	for (int i = 0; i < n; i++) {
+		ParticlePtr par = cv::makePtr<Particle>();
+		par->dynRange = rng.uniform(0, 3) * 100;
+		particles.push_back(par);
+	}
+}
+
+TEST(grid_query)
+{
+	// Every inserted rect that overlaps the query is returned once, in
+	// index order, also after rects have been moved
+	cv::RNG rng(0x6e1d);
+	RectGrid grid(size);
+	for (int frame = 0; frame < 200; frame++) {
+		grid.clear();
+		std::vector<cv::Rect> rects;
+		int n = rng.uniform(0, 200);
+		for (int i = 0; i < n; i++) {
+			rects.push_back(randomRect(rng, frame % 2));
+			grid.insert(i, rects.back());
+		}
+		for (int i = 0; i < n / 4; i++) {
+			int j = rng.uniform(0, n);
+			grid.remove(j, rects[j]);
+			rects[j] = randomRect(rng, frame % 2);
+			grid.insert(j, rects[j]);
+		}
+		
+		std::vector<int> idx;
+		for (int q = 0; q < 50; q++) {
+			cv::Rect rect = randomRect(rng, frame % 2);
+			grid.query(rect, idx);
+			CHECKF(std::is_sorted(idx.begin(), idx.end()), "frame %d", frame);
+			CHECKF(std::adjacent_find(idx.begin(), idx.end()) == idx.end(), "frame %d", frame);
+			for (int i = 0; i < n; i++) {
+				if ((rect & rects[i]).area() > 0)
+					CHECKF(std::binary_search(idx.begin(), idx.end(), i), "frame %d, rect %d missing", frame, i);
+			}
+		}
+	}
+}
+
+TEST(grid_unique)
+{
+	Config cfg;
+	cfg.img.size = size;
+	ImagePool pool;
+	AnalysisProbe analysis(&cfg, &pool);
+	
+	cv::RNG rng(0x0e1a);
+	std::vector<SegmentPtr> segments;
+	std::vector<ParticlePtr> particles;
+	for (int frame = 0; frame < 3000; frame++) {
+		bool dense = frame % 2;
+		randomSegments(rng, rng.uniform(0, 400), dense, segments, particles);
+		
+		std::vector<SegmentPtr> segmentsUnique, segmentsRef;
+		std::vector<ParticlePtr> particlesUnique, particlesRef;
+		analysis.unique(segments, particles, segmentsUnique, particlesUnique);
+		uniqueReference(segments, particles, segmentsRef, particlesRef);
+		
+		CHECKF(
+			segmentsUnique.size() == segmentsRef.size(),
+			"frame %d, %zu unique instead of %zu", frame, segmentsUnique.size(), segmentsRef.size()
+		);
+		for (size_t i = 0; i < segmentsRef.size(); i++) {
+			CHECKF(segmentsUnique[i] == segmentsRef[i], "frame %d, segment %zu", frame, i);
+			CHECKF(particlesUnique[i] == particlesRef[i], "frame %d, particle %zu", frame, i);
+		}
+	}
+}
@@ -0,0 +1,149 @@
+#include "icemet/core/config.hpp"
+#include "icemet/core/file.hpp"
+#include "icemet/core/label.hpp"
+#include "icemet/core/mask.hpp"
+#include "icemet/core/pool.hpp"
+#include "server/analysis.hpp"
+#include "test/test.hpp"
+
+#include <opencv2/core.hpp>
+#include <opencv2/icemet.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <vector>
+
+// Local to this file, the other tests expose other members
+namespace {
+
+class AnalysisProbe : public Analysis {
+public:
+	using Analysis::Analysis;
+	using Analysis::analyse;
+};
+
+}
+
+// Segment-like image with filled and hollow particles, thin lines and single
+// pixels. Rings give holes and nested components, lines and single pixels
+// diagonal connections.
+static void randomSegment(cv::RNG& rng, cv::Mat& img)
+{
+	cv::Size2i size(rng.uniform(1, 200), rng.uniform(1, 200));
+	img.create(size, CV_8UC1);
+	img.setTo(cv::Scalar(rng.uniform(100, 200)));
+	for (int i = rng.uniform(0, 12); i > 0; i--) {
+		cv::Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+		cv::Scalar color(rng.uniform(0, 100));
+		int radius = rng.uniform(0, 40);
+		switch (rng.uniform(0, 3)) {
+		case 0:
+			cv::circle(img, center, radius, color, cv::FILLED);
+			break;
+		case 1:
+			cv::circle(img, center, radius, color, rng.uniform(1, 4));
+			break;
+		default:
+			cv::line(img, center, cv::Point(rng.uniform(0, size.width), rng.uniform(0, size.height)), color);
+		}
+	}
+	for (int i = size.area() / 50; i > 0; i--)
+		img.at<unsigned char>(rng.uniform(0, size.height), rng.uniform(0, size.width)) = rng.uniform(0, 256);
+}
+
+static bool sameMask(const Mask& m1, const Mask& m2)
+{
+	if (m1.size() != m2.size())
+		return false;
+	if (m1.empty() || m2.empty())
+		return m1.empty() == m2.empty();
+	cv::Mat img1, img2;
+	m1.expand(img1);
+	m2.expand(img2);
+	return cv::countNonZero(img1 != img2) == 0;
+}
+
+TEST(label_contours)
+{
+	// Every external component matches the contour findContours traces
+	// around it: order, box, filled area, perimeter, mask and the points
+	// inside it
+	cv::RNG rng(0x1abe1);
+	Labeler labeler;
+	cv::Mat img, imgTh;
+	for (int n = 0; n < 3600; n++) {
+		randomSegment(rng, img);
+		int th = rng.uniform(0, 256);
+		cv::threshold(img, imgTh, th, 255, cv::THRESH_BINARY_INV);
+		std::vector<std::vector<cv::Point>> contours;
+		cv::findContours(imgTh, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+		labeler.label(img, th);
+		const std::vector<int>& external = labeler.external();
+		CHECKF(external.size() == contours.size(), "image %d, %zu components, %zu contours", n, external.size(), contours.size());
+		
+		int nc = contours.size();
+		for (int i = 0; i < nc; i++) {
+			// findContours lists the components in reverse raster order
+			int idx = labeler.component(contours[i][0]);
+			CHECKF(idx == external[nc-1-i], "image %d, contour %d", n, i);
+			
+			const LabelComp& comp = labeler.comp(idx);
+			CHECKF(comp.rect == cv::boundingRect(contours[i]), "image %d, contour %d", n, i);
+			cv::Mat imgPar = cv::Mat::zeros(img.size(), CV_8UC1);
+			cv::drawContours(imgPar, contours, i, 255, cv::FILLED);
+			CHECKF(comp.filled == cv::countNonZero(imgPar), "image %d, contour %d", n, i);
+			double perim = cv::arcLength(contours[i], true);
+			CHECKF(labeler.perimeter(idx) == perim, "image %d, contour %d, perimeter %.17g", n, i, perim);
+			CHECKF(sameMask(labeler.mask(idx), Mask(imgPar)), "image %d, contour %d", n, i);
+			
+			for (int k = 0; k < 20; k++) {
+				cv::Point p(rng.uniform(0, img.cols), rng.uniform(0, img.rows));
+				bool inside = cv::pointPolygonTest(contours[i], p, false) >= 0.0;
+				CHECKF(inside == (labeler.component(p) == idx), "image %d, contour %d, point (%d, %d)", n, i, p.x, p.y);
+			}
+		}
+	}
+}
+
+TEST(label_particles)
+{
+	// Both measurement paths give identical particles
+	Config cfg;
+	cfg.img.size = cv::Size2i(256, 256);
+	cfg.img.border = cv::Size2i(8, 8);
+	cfg.keeps.particles = true;
+	cfg.hologram.psz = 3.45e-6;
+	cfg.hologram.dist = 0.0;
+	cfg.particle.thFact = 0.5;
+	cfg.diamCorr.enabled = false;
+	Config cfgContours(cfg);
+	cfg.particle.labels = true;
+	cfgContours.particle.labels = false;
+	
+	ImagePool pool;
+	AnalysisProbe labels(&cfg, &pool);
+	AnalysisProbe contours(&cfgContours, &pool);
+	cv::Mat bufTh(cfg.img.size, CV_8UC1), bufPar(cfg.img.size, CV_8UC1);
+	
+	cv::RNG rng(0x9a47);
+	FilePtr file = cv::makePtr<File>();
+	for (int n = 0; n < 3600; n++) {
+		file->param.bgVal = rng.uniform(100, 200);
+		cfg.particle.thFact = cfgContours.particle.thFact = rng.uniform(0.2f, 0.8f);
+		SegmentPtr segm = cv::makePtr<Segment>();
+		randomSegment(rng, segm->img);
+		segm->rect = cv::Rect(cv::Point(rng.uniform(0, 56), rng.uniform(0, 56)), segm->img.size());
+		segm->z = rng.uniform(0.01f, 0.1f);
+		
+		ParticlePtr par1, par2;
+		bool found1 = labels.analyse(file, segm, bufTh, bufPar, par1);
+		bool found2 = contours.analyse(file, segm, bufTh, bufPar, par2);
+		CHECKF(found1 == found2, "segment %d", n);
+		if (!found1)
+			continue;
+		CHECKF(par1->x == par2->x && par1->y == par2->y && par1->z == par2->z, "segment %d", n);
+		CHECKF(par1->diam == par2->diam && par1->diamCorr == par2->diamCorr, "segment %d", n);
+		CHECKF(par1->circularity == par2->circularity, "segment %d", n);
+		CHECKF(par1->dynRange == par2->dynRange && par1->effPxSz == par2->effPxSz, "segment %d", n);
+		CHECKF(sameMask(par1->mask, par2->mask), "segment %d", n);
+	}
+}
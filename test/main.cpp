@@ -0,0 +1,93 @@
+#include "test.hpp"
+
+#include "icemet/util/log.hpp"
+#include "icemet/util/time.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+typedef struct _test_entry {
+	std::string name;
+	TestFunc func;
+} TestEntry;
+
+static const char* usageStr = "Usage: icemet-test [options] [prefix...]\n";
+static const char* helpStr =
+"Runs the tests whose name starts with one of the prefixes, or all tests.\n"
+"\n"
+"Options:\n"
+"  -h                Print this help message and exit\n"
+"  -d                Enable debug messages.\n";
+
+static std::vector<TestEntry>& entries()
+{
+	static std::vector<TestEntry> vec;
+	return vec;
+}
+
+Test::Test(const char* name, TestFunc func)
+{
+	entries().push_back({name, func});
+}
+
+void Test::fail(const char* fn, int line, const std::string& msg)
+{
+	throw(std::runtime_error(strfmt("%s:%d: %s", fn, line, msg.c_str())));
+}
+
+int main(int argc, char* argv[])
+{
+	LogLevel loglevel = LOG_WARNING;
+	std::vector<std::string> prefixes;
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		if (arg[0] == '-') {
+			if (!arg.compare("-h")) {
+				printf("%s\n%s", usageStr, helpStr);
+				return EXIT_SUCCESS;
+			}
+			else if (!arg.compare("-d")) {
+				loglevel = LOG_DEBUG;
+			}
+			else {
+				printf("Invalid option '%s'\n", arg.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+		else {
+			prefixes.push_back(arg);
+		}
+	}
+	Log::setLevel(loglevel);
+	
+	int run = 0;
+	int failed = 0;
+	for (const auto& entry : entries()) {
+		bool selected = prefixes.empty();
+		for (const auto& prefix : prefixes)
+			selected |= entry.name.compare(0, prefix.size(), prefix) == 0;
+		if (!selected)
+			continue;
+		
+		Measure m;
+		run++;
+		try {
+			entry.func();
+			printf("PASS %s (%.2f s)\n", entry.name.c_str(), m.time());
+		}
+		catch (std::exception& e) {
+			printf("FAIL %s: %s\n", entry.name.c_str(), e.what());
+			failed++;
+		}
+	}
+	if (!run) {
+		printf("No tests selected\n");
+		return EXIT_FAILURE;
+	}
+	printf("%d/%d passed\n", run - failed, run);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,28 @@
+#ifndef ICEMET_TEST_TEST_H
+#define ICEMET_TEST_TEST_H
+
+#include "icemet/util/strfmt.hpp"
+
+#include <functional>
+#include <string>
+
+typedef std::function<void()> TestFunc;
+
+// Registry of the tests. A test fails by throwing, usually from CHECK.
+class Test {
+public:
+	Test(const char* name, TestFunc func);
+	
+	[[noreturn]] static void fail(const char* fn, int line, const std::string& msg);
+};
+
+#define TEST(name) \
+	static void test_##name(); \
+	static Test test_entry_##name(#name, test_##name); \
+	static void test_##name()
+#define CHECK(expr) \
+	do { if (!(expr)) Test::fail(__FILE__, __LINE__, #expr); } while (0)
+#define CHECKF(expr, ...) \
+	do { if (!(expr)) Test::fail(__FILE__, __LINE__, std::string(#expr ": ") + strfmt(__VA_ARGS__)); } while (0)
+
+#endif